@@ -0,0 +1,75 @@
+// Append-only, random and sequential-typing traces, built once per balancing scheme (BalanceBench_AVL and
+// BalanceBench_TREAP) so the two can be compared on the same machine. Both define PIECETREE_COUNTERS, the
+// fix-up work per edit is reported next to the timings.
+// usage: BalanceBench_<scheme> [edits per trace]
+#include "../include/PieceTree.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double millis(Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); }
+
+enum class Trace { Append, Random, Typing };
+
+// where the next single-byte insert of the trace goes, typing moves to a random spot every 1000 keystrokes
+PieceTree::Offset nextOffset(Trace trace, std::mt19937 &rng, int edit, PieceTree::Offset length,
+                             PieceTree::Offset &cursor) {
+    switch (trace) {
+    case Trace::Append:
+        return length;
+    case Trace::Random:
+        return rng() % (length + 1);
+    case Trace::Typing:
+        if (edit % 1000 == 0)
+            cursor = rng() % (length + 1);
+        return cursor++;
+    }
+    return length;
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    int edits = argc > 1 ? std::atoi(argv[1]) : 200'000;
+    std::printf("balance: %s, %d single-byte edits per trace\n",
+                PieceTree::balance == PieceTree::Balance::Avl ? "AVL" : "treap", edits);
+    std::printf("%-8s %12s %16s %10s %10s %10s\n", "trace", "edit (ns)", "line lookup (ns)", "updates", "checks",
+                "rotations");
+
+    for (auto [trace, name] : {std::pair{Trace::Append, "append"}, {Trace::Random, "random"},
+                               {Trace::Typing, "typing"}}) {
+        std::mt19937 rng(1);
+        PieceTree tree;
+        PieceTree::Offset length = 0, cursor = 0;
+        PieceTree::balance_counters = {};
+
+        auto start = Clock::now();
+        for (int i = 0; i < edits; i++) {
+            PieceTree::Offset offset = nextOffset(trace, rng, i, length, cursor);
+            PieceTree::Offset line = tree.lineAt(offset);
+            // every seventh byte is a line break, offsets in the Added buffer never touch so nothing merges
+            PieceTree::Piece piece{NodeType::Added, 2 * static_cast<PieceTree::Offset>(i), 1, {}};
+            if (i % 7 == 0)
+                piece.line_breaks = {0};
+            tree.insert(piece, line, offset - tree.lineStartOffset(line));
+            length++;
+        }
+        auto edited = Clock::now();
+        PieceTree::BalanceCounters counters = PieceTree::balance_counters;
+
+        PieceTree::Offset lines = tree.metrics().line_breaks + 1;
+        volatile PieceTree::Offset sink = 0; // keeps the lookups from being optimized away
+        for (int i = 0; i < edits; i++)
+            sink = tree.lineStartOffset(static_cast<PieceTree::Offset>(rng() % lines));
+        auto looked_up = Clock::now();
+
+        std::printf("%-8s %12.0f %16.0f %10.1f %10.1f %10.2f\n", name, millis(edited - start) * 1e6 / edits,
+                    millis(looked_up - edited) * 1e6 / edits, static_cast<double>(counters.updates) / edits,
+                    static_cast<double>(counters.balance_checks) / edits,
+                    static_cast<double>(counters.rotations) / edits);
+    }
+}
@@ -0,0 +1,75 @@
+// Cost of publishing a version and read throughput of ConcurrentPieceTree while the writer keeps publishing.
+// usage: ConcurrentBench [readers] [seconds per size]
+#include "../include/ConcurrentPieceTree.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double millis(Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); }
+
+// pieces of one line each, laid out one after another in the Added buffer
+PieceTree document(int pieces) {
+    std::vector<PieceTree::Piece> list;
+    list.reserve(pieces);
+    for (int i = 0; i < pieces; i++)
+        list.push_back({NodeType::Added, static_cast<PieceTree::Offset>(i) * 40, 40, {39}});
+    return PieceTree::fromPieces(std::move(list));
+}
+} // namespace
+
+int main(int argc, char **argv) {
+    int reader_count = argc > 1 ? std::atoi(argv[1]) : 4;
+    double seconds = argc > 2 ? std::atof(argv[2]) : 1.0;
+
+    std::printf("%10s %14s %12s %16s\n", "pieces", "publish (ms)", "publishes", "reads/s");
+    for (int pieces : {10'000, 100'000, 1'000'000}) {
+        ConcurrentPieceTree doc(document(pieces));
+        std::atomic<bool> done = false;
+        std::atomic<long> reads = 0;
+
+        std::vector<std::thread> readers;
+        for (int r = 0; r < reader_count; r++) {
+            readers.emplace_back([&, r] {
+                ConcurrentPieceTree::Reader reader = doc.reader();
+                std::mt19937 rng(r);
+                long local = 0;
+                while (!done.load(std::memory_order_relaxed)) {
+                    ConcurrentPieceTree::Snapshot snapshot = reader.pin();
+                    PieceTree::Offset lines = snapshot->metrics().line_breaks;
+                    for (int i = 0; i < 100; i++)
+                        (void)snapshot->lineStartOffset(static_cast<PieceTree::Offset>(rng() % lines));
+                    local += 100;
+                }
+                reads += local;
+            });
+        }
+
+        // one keystroke per publish, the worst case for a writer that does not stage
+        std::mt19937 rng(1);
+        int publishes = 0;
+        Clock::duration publishing{};
+        auto start = Clock::now();
+        while (Clock::now() - start < std::chrono::duration<double>(seconds)) {
+            auto line = static_cast<PieceTree::Offset>(rng() % pieces);
+            auto before = Clock::now();
+            doc.edit([&](PieceTree &tree) { tree.insert({NodeType::Added, 0, 1, {}}, line, 0); });
+            publishing += Clock::now() - before;
+            publishes++;
+        }
+        auto elapsed = Clock::now() - start;
+        done = true;
+        for (std::thread &reader : readers)
+            reader.join();
+
+        std::printf("%10d %14.3f %12d %16.0f\n", pieces, millis(publishing) / publishes, publishes,
+                    static_cast<double>(reads) / (millis(elapsed) / 1000));
+    }
+}
@@ -0,0 +1,62 @@
+// Memory and speed of the offset width, built once with 64-bit offsets (OffsetBench_64) and once with
+// PIECETREE_32BIT_OFFSETS (OffsetBench_32). The document is a scanned text edited at random places, so the
+// tree holds many pieces with line break tables.
+// usage: OffsetBench_<bits> [lines] [edits]
+#include "../include/PieceTree.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+
+namespace {
+using Clock = std::chrono::steady_clock;
+
+double millis(Clock::duration duration) { return std::chrono::duration<double, std::milli>(duration).count(); }
+} // namespace
+
+int main(int argc, char **argv) {
+    int lines = argc > 1 ? std::atoi(argv[1]) : 1'000'000;
+    int edits = argc > 2 ? std::atoi(argv[2]) : 200'000;
+
+    std::string original;
+    for (int i = 0; i < lines; i++)
+        original += "line " + std::to_string(i) + " of the document\n";
+    std::string added;
+    PieceTree tree;
+
+    auto start = Clock::now();
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, original), 0, 0);
+    auto scanned = Clock::now();
+
+    std::mt19937 rng(1);
+    for (int i = 0; i < edits; i++) {
+        auto length = tree.metrics().length;
+        PieceTree::Offset offset = rng() % (length + 1);
+        PieceTree::Offset line = tree.lineAt(offset);
+        PieceTree::Offset column = offset - tree.lineStartOffset(line);
+        if (i % 3 == 0 && offset < length) {
+            tree.remove(line, column, 1 + rng() % std::min<PieceTree::Offset>(20, length - offset));
+        } else {
+            std::string text = i % 5 == 0 ? "new\nline" : "typed";
+            tree.insert(PieceTree::Piece::fromText(NodeType::Added, added.size(), text), line, column);
+            added += text;
+        }
+    }
+    auto edited = Clock::now();
+
+    PieceTree::Offset total_lines = tree.metrics().line_breaks + 1;
+    volatile PieceTree::Offset sink = 0; // keeps the lookups from being optimized away
+    for (int i = 0; i < edits; i++)
+        sink = tree.lineStartOffset(static_cast<PieceTree::Offset>(rng() % total_lines));
+    auto looked_up = Clock::now();
+
+    PieceTree::MemoryUsage usage = tree.memoryUsage(static_cast<PieceTree::Offset>(added.size()));
+    std::printf("offsets: %zu-bit, %d lines, %d edits, %zu pieces\n", sizeof(PieceTree::Offset) * 8, lines, edits,
+                usage.pieces);
+    std::printf("scan %.0f ms, edit %.0f ns, line lookup %.0f ns\n", millis(scanned - start),
+                millis(edited - scanned) * 1e6 / edits, millis(looked_up - edited) * 1e6 / edits);
+    std::printf("node %zu B, nodes %.1f MB, line break tables %.1f MB, tree %.1f MB\n", usage.node_bytes / usage.pieces,
+                usage.node_bytes / 1e6, usage.line_break_bytes / 1e6, usage.treeBytes() / 1e6);
+}
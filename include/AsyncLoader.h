@@ -0,0 +1,134 @@
+#ifndef AsyncLoader_H
+#define AsyncLoader_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stop_token>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads, co_await pool continues the coroutine on one of them. Every task using the
+// pool has to be done before the pool is destroyed.
+class ThreadPool {
+  public:
+    explicit ThreadPool(std::size_t threads = std::max(1u, std::thread::hardware_concurrency()));
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+
+    void post(std::coroutine_handle<> continuation);
+
+    auto operator co_await() {
+        struct Awaiter {
+            ThreadPool &pool;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> continuation) { pool.post(continuation); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable_any available;
+    std::deque<std::coroutine_handle<>> queue;
+    std::vector<std::jthread> workers; // last, they are stopped and joined before the queue goes away
+};
+
+// Continuations queued for the thread owning a tree, e.g. the UI thread, which runs them from its event loop.
+// co_await owner continues the coroutine inside the next runPending() call.
+class OwnerExecutor {
+  public:
+    void post(std::coroutine_handle<> continuation);
+    // resumes everything queued, waiting up to wait for the first continuation, returns how many ran
+    std::size_t runPending(std::chrono::milliseconds wait = std::chrono::milliseconds(0));
+
+    auto operator co_await() {
+        struct Awaiter {
+            OwnerExecutor &owner;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> continuation) { owner.post(continuation); }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this};
+    }
+
+  private:
+    std::mutex mutex;
+    std::condition_variable available;
+    std::vector<std::coroutine_handle<>> queue;
+};
+
+class LoadTask;
+
+struct LoadProgress {
+    PieceTree::Offset loaded = 0; // bytes appended to the tree
+    PieceTree::Offset total = 0;  // file size
+    bool cancelled = false;
+};
+
+// Original buffer of a file being loaded. Chunks are read into their final place, the owner only reads
+// the ones already appended to the tree, so the buffer never moves while the load runs.
+class OriginalBuffer {
+  public:
+    [[nodiscard]] std::string_view text(const PieceTree::Piece &piece) const {
+        return {data.get() + piece.offset, static_cast<std::size_t>(piece.length)};
+    }
+    [[nodiscard]] PieceTree::Offset size() const { return length; }
+
+  private:
+    std::unique_ptr<char[]> data;
+    PieceTree::Offset length = 0;
+
+    friend LoadTask openAsync(std::string, PieceTree &, OriginalBuffer &, ThreadPool &, OwnerExecutor &,
+                              std::stop_token, std::function<void(const LoadProgress &)>, PieceTree::Offset);
+};
+
+// Handle of a running openAsync. It completes on the owner thread, so done() and result() are meant to be
+// called there, and it must not be destroyed before it is done.
+class LoadTask {
+  public:
+    struct promise_type {
+        LoadProgress progress;
+        std::exception_ptr error;
+
+        LoadTask get_return_object() { return LoadTask(std::coroutine_handle<promise_type>::from_promise(*this)); }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        void return_value(const LoadProgress &result) { progress = result; }
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    LoadTask(LoadTask &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+    LoadTask &operator=(LoadTask &&) = delete;
+    ~LoadTask();
+
+    [[nodiscard]] bool done() const { return handle.done(); }
+    // rethrows what failed the load
+    [[nodiscard]] LoadProgress result() const;
+
+  private:
+    std::coroutine_handle<promise_type> handle;
+
+    explicit LoadTask(std::coroutine_handle<promise_type> h) : handle(h) {}
+};
+
+// Streams path into buffer chunk by chunk. Reading and scanning run on the pool, every chunk is appended to
+// tree on the owner thread, so the loaded part can be viewed and edited meanwhile. Chunks end on UTF-8
+// character boundaries. A stop request ends the load after the current chunk, progress is reported on the
+// owner thread after every chunk. tree, buffer, pool and owner must outlive the task.
+LoadTask openAsync(std::string path, PieceTree &tree, OriginalBuffer &buffer, ThreadPool &pool, OwnerExecutor &owner,
+                   std::stop_token stop, std::function<void(const LoadProgress &)> progress = {},
+                   PieceTree::Offset chunk_size = 1 << 20);
+
+#endif // AsyncLoader_H
@@ -0,0 +1,96 @@
+#ifndef BufferStore_H
+#define BufferStore_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+class BufferStore;
+
+// Immutable Original text shared by every document with the same content, scanned once when interned.
+class SharedBuffer {
+  public:
+    [[nodiscard]] std::string_view text() const { return data; }
+    [[nodiscard]] std::uint64_t hash() const { return content_hash; }
+    // the whole text as one Original piece with its line breaks and multibyte characters
+    [[nodiscard]] const PieceTree::Piece &index() const { return scanned; }
+    // a tree over the whole buffer built from the shared index, nothing is rescanned or copied: the piece
+    // shares the tables of the index until an edit splits it
+    [[nodiscard]] PieceTree makeTree() const;
+
+  private:
+    std::string data;
+    std::uint64_t content_hash = 0;
+    PieceTree::Piece scanned;
+
+    friend class BufferStore;
+};
+
+// Content addressed, reference counted store of Original buffers, safe to use from several threads. A buffer
+// lives while a document holds it, the store only keeps weak references. It also recycles the fixed size
+// blocks of AddedBuffer so that documents opened and closed all the time reuse the same memory.
+class BufferStore {
+  public:
+    static constexpr std::size_t block_size = 64 * 1024;
+
+    BufferStore() = default;
+    BufferStore(const BufferStore &) = delete;
+    BufferStore &operator=(const BufferStore &) = delete;
+
+    // the process wide store
+    static BufferStore &global();
+
+    // returns the buffer already holding equal text, or a new one scanned from contents
+    std::shared_ptr<const SharedBuffer> intern(std::string contents);
+    // distinct buffers still in use
+    [[nodiscard]] std::size_t size();
+    [[nodiscard]] std::size_t freeBlocks();
+
+  private:
+    static constexpr std::size_t max_free_blocks = 1024;
+
+    std::mutex mutex;
+    std::unordered_multimap<std::uint64_t, std::weak_ptr<const SharedBuffer>> buffers;
+    std::vector<std::unique_ptr<char[]>> free_blocks;
+
+    std::unique_ptr<char[]> acquireBlock();
+    void releaseBlock(std::unique_ptr<char[]> block);
+
+    friend class AddedBuffer;
+};
+
+// Append-only Added buffer of one document made of blocks from a BufferStore. Text never moves once appended,
+// a piece never spans two blocks, and closing the document hands the blocks back for the next one. Offsets
+// skip one value between blocks, so only text of the same block is contiguous in offsets.
+class AddedBuffer {
+  public:
+    explicit AddedBuffer(BufferStore &store = BufferStore::global()) : store(store) {}
+    AddedBuffer(const AddedBuffer &) = delete;
+    AddedBuffer &operator=(const AddedBuffer &) = delete;
+    ~AddedBuffer();
+
+    // copies text in and returns the Added piece referring to it
+    PieceTree::Piece append(std::string_view text);
+    [[nodiscard]] std::string_view text(const PieceTree::Piece &piece) const;
+
+  private:
+    struct Block {
+        PieceTree::Offset start; // buffer offset of the first byte
+        std::unique_ptr<char[]> data;
+        std::size_t capacity;
+        std::size_t used = 0;
+    };
+
+    BufferStore &store;
+    std::vector<Block> blocks;
+};
+
+#endif // BufferStore_H
@@ -0,0 +1,122 @@
+#ifndef ConcurrentPieceTree_H
+#define ConcurrentPieceTree_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Epoch-based reclamation. A reader pins the current epoch while it traverses, the writer retires objects
+// with the epoch they were unpublished in, and an object is freed once every pinned epoch is newer.
+class EpochManager {
+  public:
+    static constexpr std::size_t max_readers = 64;
+    static constexpr std::uint64_t no_pin = UINT64_MAX;
+
+    std::size_t registerReader();
+    void unregisterReader(std::size_t slot);
+    // pins nest: the slot keeps the epoch of its first pin until the last one is released
+    void pin(std::size_t slot);
+    void unpin(std::size_t slot);
+
+    // starts a new epoch, returns the one objects unpublished before the call belong to
+    std::uint64_t advance();
+    [[nodiscard]] std::uint64_t oldestPinned() const;
+
+  private:
+    struct alignas(64) Slot {
+        std::atomic<std::uint64_t> epoch{0}; // 0 while not pinned
+        std::atomic<bool> used{false};
+        std::uint32_t pins = 0; // only touched by the thread owning the slot
+    };
+
+    std::atomic<std::uint64_t> global_epoch{1};
+    std::array<Slot, max_readers> slots;
+};
+
+// Single writer, many lock-free readers. The writer edits a private tree and publishes an immutable
+// copy of it with one atomic store, readers pin an epoch and traverse the version they loaded. Lookups
+// index lazily loaded pieces in place, so a version is fully indexed before it is published.
+class ConcurrentPieceTree {
+  public:
+    class Snapshot {
+      public:
+        Snapshot(const Snapshot &) = delete;
+        Snapshot &operator=(const Snapshot &) = delete;
+        ~Snapshot();
+
+        const PieceTree &operator*() const { return *tree; }
+        const PieceTree *operator->() const { return tree; }
+
+      private:
+        friend class ConcurrentPieceTree;
+        Snapshot(EpochManager &epochs, std::size_t slot, const PieceTree *tree);
+
+        EpochManager &epochs;
+        std::size_t slot;
+        const PieceTree *tree;
+    };
+
+    // owns one epoch slot, every reading thread keeps its own. Snapshots of one reader may overlap, the
+    // oldest one keeps the slot pinned
+    class Reader {
+      public:
+        Reader(Reader &&other) noexcept;
+        Reader(const Reader &) = delete;
+        Reader &operator=(const Reader &) = delete;
+        Reader &operator=(Reader &&) = delete;
+        ~Reader();
+
+        [[nodiscard]] Snapshot pin() const;
+
+      private:
+        friend class ConcurrentPieceTree;
+        Reader(const ConcurrentPieceTree &owner, std::size_t slot);
+
+        const ConcurrentPieceTree *owner;
+        std::size_t slot;
+    };
+
+    // an initial tree with unindexed pieces needs a text source, it is indexed here
+    explicit ConcurrentPieceTree(PieceTree &&initial = PieceTree());
+    ConcurrentPieceTree(const ConcurrentPieceTree &) = delete;
+    ConcurrentPieceTree &operator=(const ConcurrentPieceTree &) = delete;
+    ~ConcurrentPieceTree();
+
+    Reader reader();
+
+    // applies change to the writer's tree and publishes the result, writers are serialized, readers never
+    // wait. Publishing clones the whole tree and frees the version it replaces once unpinned, O(n) in pieces
+    // (about 40 ms at 100k pieces, see bench/ConcurrentBench), so a burst of keystrokes should go through stage
+    // and be published once
+    void edit(const std::function<void(PieceTree &)> &change);
+    // applies change without publishing it, readers keep seeing the last published version
+    void stage(const std::function<void(PieceTree &)> &change);
+    // publishes everything staged since the last publish, does nothing when nothing was staged. Pieces left
+    // unindexed by the changes are scanned first, without a text source that throws and nothing is published
+    void publish();
+
+    // retired versions still waiting for readers from older epochs
+    [[nodiscard]] std::size_t pendingReclamation();
+
+  private:
+    void publishLocked();
+    void reclaim();
+
+    mutable EpochManager epochs;
+    std::atomic<const PieceTree *> published;
+
+    std::mutex writer_mutex;
+    PieceTree writer_tree;
+    bool staged = false;
+    std::vector<std::pair<std::uint64_t, const PieceTree *>> retired;
+};
+
+#endif // ConcurrentPieceTree_H
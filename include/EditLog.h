@@ -0,0 +1,77 @@
+#ifndef EditLog_H
+#define EditLog_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// Append-only binary log of insert and remove operations. After a short header every record is a tag byte
+// followed by varint encoded line, column and length, inserts carry their text inline. A record cut short by
+// a crash is detected on reading and dropped.
+namespace EditLog {
+using Offset = PieceTree::Offset;
+
+enum class OperationType : std::uint8_t { Insert = 1, Remove = 2 };
+
+struct Operation {
+    OperationType type;
+    Offset line;
+    Offset column;
+    Offset length;
+    std::string_view text; // inserted text, points into the decoded data
+};
+
+// Records are buffered and written with a single write and fsync per commit, so many edits share the cost
+// of one sync. A commit also happens once the buffer grows past commit_threshold bytes.
+class Writer {
+  public:
+    // opens or creates the log, a torn record at the end of an existing log is truncated
+    explicit Writer(const std::string &path, std::size_t commit_threshold = 1 << 16);
+    Writer(const Writer &) = delete;
+    Writer &operator=(const Writer &) = delete;
+    ~Writer(); // commits what is buffered
+
+    void logInsert(Offset line, Offset column, std::string_view text);
+    void logRemove(Offset line, Offset column, Offset length);
+    // makes every logged record durable
+    void commit();
+    [[nodiscard]] std::size_t buffered() const { return buffer.size(); }
+
+  private:
+    int fd = -1;
+    std::size_t commit_threshold;
+    std::string buffer;
+
+    void putVarint(std::uint64_t value);
+};
+
+class Reader {
+  public:
+    // data is the whole log including the header, it must outlive the reader and the operations it returns
+    explicit Reader(std::string_view data);
+
+    // false at the end of the log or at a truncated last record, throws at a record of unknown type
+    bool next(Operation &operation);
+    // bytes of data covered by complete records
+    [[nodiscard]] std::size_t consumed() const { return position; }
+
+    static std::string readFile(const std::string &path);
+
+  private:
+    std::string_view data;
+    std::size_t position = 0;
+
+    bool getVarint(std::size_t &at, std::uint64_t &value) const;
+};
+
+// Applies every operation of the log to tree, the inserted text is appended to added and referenced by Added
+// pieces. Consecutive typing and backspacing at the same spot is merged into one piece before it reaches the
+// tree, and listeners receive the whole replay as one batch. Returns the number of operations read.
+std::size_t replay(std::string_view data, PieceTree &tree, std::string &added);
+} // namespace EditLog
+
+#endif // EditLog_H
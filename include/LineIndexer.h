@@ -0,0 +1,43 @@
+#ifndef LineIndexer_H
+#define LineIndexer_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Scans unindexed pieces on a worker thread. The tree is only touched by its owner: schedule() hands the
+// unindexed pieces over, apply() moves the finished ones back into the tree in one pass.
+class LineIndexer {
+  public:
+    // source is called from the worker thread, the buffers it reads must not change while indexing
+    explicit LineIndexer(PieceTree::TextSource source);
+    LineIndexer(const LineIndexer &) = delete;
+    LineIndexer &operator=(const LineIndexer &) = delete;
+    ~LineIndexer(); // stops after the piece being scanned
+
+    void schedule(const PieceTree &tree);
+    // returns the number of pieces of tree that became indexed
+    std::size_t apply(PieceTree &tree);
+    // blocks until every scheduled piece is scanned
+    void wait();
+    [[nodiscard]] bool idle();
+
+  private:
+    PieceTree::TextSource source;
+    std::mutex mutex;
+    std::condition_variable_any changed;
+    std::deque<PieceTree::Piece> queue;
+    std::vector<PieceTree::Piece> done;
+    bool scanning = false;
+    std::jthread worker; // last, it starts running in the constructor
+
+    void run(std::stop_token stop);
+};
+
+#endif // LineIndexer_H
@@ -0,0 +1,51 @@
+#ifndef LogFollower_H
+#define LogFollower_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <chrono>
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+// Follows a file that keeps growing, e.g. a log being written, and appends what is written to a tree as
+// Original pieces. The file is mapped into an address range reserved up front, the mapping grows with the file
+// and never moves, so the pieces refer to the page cache and nothing is copied. New text continues the last
+// piece, which is extended in place. A file that shrinks, as on log rotation, makes poll() throw; reading it
+// while it is truncated is undefined, the mapping cannot detect that.
+class LogFollower {
+  public:
+    // capacity is the largest file size that can be followed, it only reserves address space
+    LogFollower(const std::string &path, PieceTree &tree, std::size_t capacity = std::size_t{1} << 40);
+    LogFollower(const LogFollower &) = delete;
+    LogFollower &operator=(const LogFollower &) = delete;
+    ~LogFollower();
+
+    // appends what was written since the last call in chunks of at most PieceTree::append_merge_limit bytes,
+    // an incomplete UTF-8 character at the end waits for its remaining bytes. Returns the bytes appended
+    PieceTree::Offset poll();
+    // waits up to timeout for the file to be written to, then polls
+    PieceTree::Offset wait(std::chrono::milliseconds timeout);
+    // readable once the file was written to, for an event loop that calls poll() itself
+    [[nodiscard]] int eventFd() const { return inotify_fd; }
+
+    [[nodiscard]] std::string_view text(const PieceTree::Piece &piece) const {
+        return {base + piece.offset, static_cast<std::size_t>(piece.length)};
+    }
+    // bytes appended to the tree so far
+    [[nodiscard]] PieceTree::Offset size() const { return appended; }
+
+  private:
+    std::string path;
+    PieceTree &tree;
+    int fd = -1;
+    int inotify_fd = -1;
+    char *base = nullptr;
+    std::size_t capacity;
+    std::size_t mapped = 0; // page aligned prefix of the reservation mapped to the file
+    PieceTree::Offset appended = 0;
+};
+
+#endif // LogFollower_H
@@ -0,0 +1,84 @@
+#ifndef MarkerTree_H
+#define MarkerTree_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+// Ranges anchored to byte offsets of a document that follow its edits. Kept in a treap ordered by start,
+// shifts are applied lazily to whole subtrees and every node knows the largest end below it, so an edit
+// costs O(log m + markers touching the edit) and an overlap query O(log m + reported markers).
+class MarkerTree {
+  public:
+    using Offset = PieceTree::Offset;
+    using MarkerId = std::uint64_t;
+
+    // what happens to an edge of the range when text is inserted exactly at it
+    enum class Stickiness {
+        NeverGrows,  // inserted text stays outside of the range
+        AlwaysGrows, // inserted text at either edge becomes part of the range
+        GrowsBefore, // only text inserted at the start becomes part of the range
+        GrowsAfter,  // only text inserted at the end becomes part of the range
+    };
+
+    struct Marker {
+        MarkerId id;
+        Offset start;
+        Offset end; // inclusive edge, start == end is a point
+        Stickiness stickiness;
+    };
+
+    MarkerTree() = default;
+    MarkerTree(const MarkerTree &) = delete;
+    MarkerTree &operator=(const MarkerTree &) = delete;
+    ~MarkerTree();
+
+    MarkerId add(Offset start, Offset end, Stickiness stickiness = Stickiness::NeverGrows);
+    bool erase(MarkerId id);
+    [[nodiscard]] std::optional<Marker> get(MarkerId id) const;
+    // markers overlapping [start, end], touching edges count
+    [[nodiscard]] std::vector<Marker> query(Offset start, Offset end) const;
+    // markers overlapping the lines [first_line, last_line] of document, meant for the viewport
+    [[nodiscard]] std::vector<Marker> markersInRange(const PieceTree &document, Offset first_line,
+                                                     Offset last_line) const;
+    [[nodiscard]] std::size_t size() const { return by_id.size(); }
+
+    void onInsert(Offset offset, Offset length);
+    void onRemove(Offset offset, Offset length);
+
+  private:
+    struct Node {
+        MarkerId id;
+        Stickiness stickiness;
+        Offset start;
+        Offset end;
+        Offset max_end; // largest end in the subtree
+        Offset delta = 0; // shift not yet applied to the children
+        std::uint64_t priority;
+        Node *parent = nullptr;
+        Node *left = nullptr;
+        Node *right = nullptr;
+    };
+
+    Node *root = nullptr;
+    std::unordered_map<MarkerId, Node *> by_id;
+    MarkerId next_id = 1;
+
+    static void shift(Node *node, Offset delta);
+    static void push(Node *node);
+    static Node *update(Node *node);
+    static Node *merge(Node *left, Node *right);
+    static std::pair<Node *, Node *> split(Node *node, Offset key, bool key_goes_left);
+    static void collect(Node *node, std::vector<Node *> &nodes);
+    static Node *build(std::vector<Node *> &nodes);
+    template <typename F> static void forEndsFrom(Node *node, Offset from, F &&adjust);
+    static void destroy(Node *node);
+    void queryFrom(const Node *node, Offset base, Offset start, Offset end, std::vector<Marker> &out) const;
+};
+
+#endif // MarkerTree_H
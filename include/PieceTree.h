@@ -3,15 +3,30 @@
 
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <exception>
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <new>
 #include <optional>
+#include <span>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <vector>
 
 enum class NodeType { Original, Added };
 
+// Units a document position can be expressed in: raw UTF-8 bytes, Unicode code points or UTF-16 code units
+enum class PositionUnit { Byte, CodePoint, Utf16 };
+
+// Line terminators; lines always end at an LF, a CR before it belongs to the line ending
+enum class LineEnding { Lf, CrLf, Cr };
+
 class PieceTreeException : public std::exception {
     std::string message;
 
@@ -23,44 +38,287 @@ class PieceTreeException : public std::exception {
     [[nodiscard]] const char *what() const noexcept override { return message.c_str(); }
 };
 
+class MarkerTree;
+
 class PieceTree {
   public:
+    // type of offsets, lengths and line numbers, 64-bit unless the build opts into 32-bit to save memory
+#ifdef PIECETREE_32BIT_OFFSETS
+    using Offset = std::int32_t;
+#else
+    using Offset = std::int64_t;
+#endif
+
+    // how the tree keeps its depth logarithmic, chosen at build time (PIECETREE_BALANCE) and selected by
+    // if constexpr. AVL keeps the tree shallowest for random edits, a treap refreshes fewer nodes per append.
+    // bench/BalanceBench is built for both and compares them
+    enum class Balance { Avl, Treap };
+#ifdef PIECETREE_TREAP
+    static constexpr Balance balance = Balance::Treap;
+#else
+    static constexpr Balance balance = Balance::Avl;
+#endif
+
+    // work of the fix-up after edits, counted only in builds defining PIECETREE_COUNTERS such as the
+    // benchmarks. The counts are global and not synchronized
+    struct BalanceCounters {
+        std::uint64_t updates = 0;        // nodes whose aggregates were recomputed
+        std::uint64_t balance_checks = 0; // nodes whose balance was checked
+        std::uint64_t rotations = 0;
+    };
+#ifdef PIECETREE_COUNTERS
+    static constexpr bool counting = true;
+#else
+    static constexpr bool counting = false;
+#endif
+    static BalanceCounters balance_counters;
+
+    // Counts kept per piece and summed per subtree
+    struct Metrics {
+        Offset length = 0; // bytes
+        Offset line_breaks = 0;
+        Offset code_points = 0;
+        Offset utf16_units = 0;
+        Offset unindexed = 0; // pieces whose line breaks are only estimated
+        Offset pieces = 0;
+
+        [[nodiscard]] Offset get(PositionUnit unit) const;
+        Metrics &operator+=(const Metrics &other);
+        bool operator==(const Metrics &) const = default;
+    };
+
+    // polynomial hash modulo 2^61 - 1, composable: hash(a + b) = hash(a) * base^|b| + hash(b)
+    struct Hash {
+        std::uint64_t value = 0;
+        std::uint64_t power = 1; // base^length
+
+        static Hash of(std::string_view text);
+        Hash &operator+=(const Hash &right);
+        // hash of the text that remains once a prefix or suffix with the given hash is taken away
+        [[nodiscard]] Hash withoutPrefix(const Hash &prefix) const;
+        [[nodiscard]] Hash withoutSuffix(const Hash &suffix) const;
+        bool operator==(const Hash &) const = default;
+    };
+
+    // Per-piece table shared copy on write: copying a piece, as clone() and SharedBuffer::makeTree() do, only
+    // bumps a count. Reads go through the const accessors, edit() returns a vector of its own to modify, copied
+    // first if another piece still refers to it. Counts are atomic so snapshots may be released on any thread
+    template <typename T> class SharedTable {
+      public:
+        SharedTable() = default;
+        SharedTable(std::vector<T> &&items) : rep(items.empty() ? nullptr : new Rep{1, std::move(items)}) {}
+        SharedTable(std::initializer_list<T> items) : SharedTable(std::vector<T>(items)) {}
+        SharedTable(const SharedTable &other) noexcept : rep(other.rep) {
+            if (rep)
+                rep->refs.fetch_add(1, std::memory_order_relaxed);
+        }
+        SharedTable(SharedTable &&other) noexcept : rep(std::exchange(other.rep, nullptr)) {}
+        SharedTable &operator=(SharedTable other) noexcept {
+            std::swap(rep, other.rep);
+            return *this;
+        }
+        ~SharedTable() { release(); }
+
+        [[nodiscard]] std::size_t size() const { return rep ? rep->items.size() : 0; }
+        [[nodiscard]] bool empty() const { return size() == 0; }
+        [[nodiscard]] std::size_t capacity() const { return rep ? rep->items.capacity() : 0; }
+        [[nodiscard]] const T *data() const { return rep ? rep->items.data() : nullptr; }
+        [[nodiscard]] const T *begin() const { return data(); }
+        [[nodiscard]] const T *end() const { return data() + size(); }
+        const T &operator[](std::size_t i) const { return rep->items[i]; }
+        [[nodiscard]] const T &front() const { return rep->items.front(); }
+        [[nodiscard]] const T &back() const { return rep->items.back(); }
+        // other pieces refer to the same table
+        [[nodiscard]] bool shared() const { return rep && rep->refs.load(std::memory_order_acquire) > 1; }
+
+        std::vector<T> &edit() {
+            if (!rep) {
+                rep = new Rep{1, {}};
+            } else if (rep->refs.load(std::memory_order_acquire) != 1) {
+                Rep *own = new Rep{1, rep->items};
+                release();
+                rep = own;
+            }
+            return rep->items;
+        }
+        void clear() { release(); }
+        // a shared table is left alone, trimming it would take a copy
+        void shrinkToFit() {
+            if (empty())
+                release();
+            else if (!shared())
+                rep->items.shrink_to_fit();
+        }
+
+        friend bool operator==(const SharedTable &a, const SharedTable &b) { return std::ranges::equal(a, b); }
+        friend bool operator==(const SharedTable &a, const std::vector<T> &b) { return std::ranges::equal(a, b); }
+
+      private:
+        struct Rep {
+            std::atomic<std::size_t> refs;
+            std::vector<T> items;
+        };
+        Rep *rep = nullptr;
+
+        void release() {
+            if (rep && rep->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                delete rep;
+            rep = nullptr;
+        }
+    };
+
+    struct MultibyteChar {
+        Offset offset;      // 0-based, offset of the lead byte
+        std::uint8_t width; // 2..4 bytes
+        // running counts over the earlier characters of the piece, so positions are found by binary search.
+        // Kept by Piece::countMultibyte, entries pushed by hand leave them to it
+        Offset extra_bytes_before = 0;     // sum of width - 1
+        Offset surrogate_pairs_before = 0; // characters of width 4
+    };
+
     struct Piece {
         NodeType type;
-        int offset; // 0-based
-        int length;
-        std::vector<int> line_breaks; // 0-based
-
-        Piece splitAt(int split_offset);
-        void cutRightSide(int cut_offset);
-        void cutLeftSide(int cut_offset);
-        int getLine(int piece_offset);
+        Offset offset; // 0-based
+        Offset length;
+        SharedTable<Offset> line_breaks;            // 0-based
+        SharedTable<MultibyteChar> multibyte_chars; // 0-based, only non-ASCII code points are stored
+        // set while the text is not scanned yet, line_breaks and multibyte_chars are empty until then
+        std::optional<Offset> estimated_line_breaks;
+        SharedTable<Offset> carriage_returns; // 0-based offsets of every CR, empty until scanned
+
+        // builds a piece over text located at buffer offset, line breaks and code points are counted while scanning
+        static Piece fromText(NodeType type, Offset offset, std::string_view text);
+        // a piece scanned only once a lookup needs its lines, until then it counts as estimated_line_breaks
+        // lines of ASCII text
+        static Piece unindexed(NodeType type, Offset offset, Offset length, Offset estimated_line_breaks);
+        [[nodiscard]] bool indexed() const { return !estimated_line_breaks; }
+
+        Piece splitAt(Offset split_offset);
+        Offset getLine(Offset piece_offset);
+        [[nodiscard]] Metrics metricsBefore(Offset piece_offset) const;
+        [[nodiscard]] Offset byteOffsetOf(Offset value, PositionUnit unit) const;
+        // recomputes the running counts of multibyte_chars from entry from on
+        void countMultibyte(std::size_t from = 0);
+    };
+
+    // returns the text a piece refers to, provided by the owner of the Original and Added buffers
+    using TextSource = std::function<std::string_view(const Piece &)>;
+
+    // what one mutation did, lines are 0-based and inclusive
+    struct Change {
+        Offset offset; // byte offset of the edit
+        Offset removed_length;
+        Offset inserted_length;
+        Offset first_line;       // line containing offset
+        Offset last_line_before; // last line the removed text touched
+        Offset last_line_after;  // last line the inserted text touches
+        Offset line_delta;       // last_line_after - last_line_before
+    };
+    using ChangeListener = std::function<void(std::span<const Change>)>;
+    using ListenerId = std::uint64_t;
+
+    // memory held by the tree and how much of the buffers its pieces refer to
+    struct MemoryUsage {
+        std::size_t pieces = 0;
+        std::size_t node_bytes = 0;       // nodes including their Piece
+        std::size_t line_break_bytes = 0; // allocated line break and carriage return tables
+        std::size_t multibyte_bytes = 0;  // allocated multibyte character tables
+        std::size_t spare_bytes = 0;      // part of the tables above allocated but unused
+        std::size_t shared_bytes = 0;     // tables shared with pieces outside the tree, not part of treeBytes()
+        Offset live_original_bytes = 0;   // buffer bytes some piece refers to, each counted once
+        Offset live_added_bytes = 0;
+        Offset dead_added_bytes = 0; // Added bytes no piece refers to any more
+
+        [[nodiscard]] std::size_t treeBytes() const { return node_bytes + line_break_bytes + multibyte_bytes; }
+    };
+
+    // counts of the line endings in a run of text, composed in order so that a CR ending one piece and an LF
+    // starting the next count as one CR LF
+    struct LineEndings {
+        Offset lf = 0; // LF without a CR before it
+        Offset crlf = 0;
+        Offset cr = 0; // CR without an LF after it
+        bool starts_with_lf = false;
+        bool ends_with_cr = false;
+        bool empty = true;
+
+        static LineEndings of(const Piece &piece);
+        LineEndings &operator+=(const LineEndings &right);
+        bool operator==(const LineEndings &) const = default;
+        // the most frequent ending, ties go to LF, then CR LF. LF for text without any
+        [[nodiscard]] LineEnding dominant() const;
+    };
+
+    // lines [first_line, first_line + line_count) of the old version were replaced by the given lines of the new one
+    struct DiffHunk {
+        Offset old_first_line;
+        Offset old_line_count;
+        Offset new_first_line;
+        Offset new_line_count;
     };
 
   private:
+    // line lengths in bytes of a run of text, the line breaks themselves are not counted
+    // line lengths leave out the CR of a CR LF, also when the pair is split between two runs
+    struct LineExtent {
+        Offset first = 0;   // bytes before the first line break, all of them without a break
+        Offset last = 0;    // bytes after the last line break
+        Offset longest = 0; // longest line that starts and ends inside the run
+        bool has_break = false;
+        bool ends_with_cr = false; // counted in last until an LF is found to follow it
+
+        static LineExtent of(const Piece &piece);
+        LineExtent &operator+=(const LineExtent &right);
+        bool operator==(const LineExtent &) const = default;
+    };
+
+    struct NodeBlock;
+
     class Node {
       public:
         Piece piece;
-        int left_line_count = 0;
+        Metrics own;     // metrics of piece
+        Metrics subtree; // metrics of the whole subtree, including own
+        Hash own_hash;     // only maintained while a text source is attached
+        Hash subtree_hash; // hash of the subtree text in order
+        LineExtent own_extent;
+        LineExtent subtree_extent;
+        LineEndings own_endings;
+        LineEndings subtree_endings;
+        Offset left_line_count = 0;
         int height = 0;
+        std::uint32_t priority = 0; // treap only, a parent's priority is at least that of its children
         Node *parent = nullptr;
         Node *left = nullptr;
         Node *right = nullptr;
+        NodeBlock *block = nullptr; // set for nodes copied by clone, null for nodes allocated one by one
 
         explicit Node(const Piece &p_);
         explicit Node(Piece &&p_);
 
+        void pieceChanged();
         int recalcMetadata();
+        void updateToRoot();
+        Metrics prefixMetrics();
         int bf();
         Node *rightRotation();
         Node *leftRotation();
-        Node splitAt(int split_offset);
         Node *next();
         Node *prev();
         Node *leftest();
         Node *rightest();
-        Node *remove(Node *&root);
         Node *balanceAndUpdate();
+
+        // frees a node allocated by new or, with the last of its nodes, the block it lives in
+        static void operator delete(Node *node, std::destroying_delete_t);
+    };
+
+    // storage of the nodes copied together by clone, the nodes follow the header
+    struct NodeBlock {
+        std::atomic<std::size_t> live; // nodes not deleted yet, edits on different clones may free them
+
+        static NodeBlock *allocate(std::size_t count);
+        Node *nodes();
     };
     class Iterator {
       public:
@@ -93,23 +351,150 @@ class PieceTree {
 
     struct Position {
         Node *node;
-        int piece_offset;
+        Offset piece_offset;
 
-        Position(Node *n, const int o) : node(n), piece_offset(o) {}
+        Position(Node *n, const Offset o) : node(n), piece_offset(o) {}
     };
 
     Node *root = nullptr;
+    Node *tail = nullptr; // rightmost node while only appends happen, reset by every other edit
+    TextSource text_source;
+    std::unique_ptr<MarkerTree> marker_tree; // created on first use
+
+    std::vector<std::pair<ListenerId, ChangeListener>> listeners;
+    std::vector<Change> pending_changes; // reused between batches, cleared without releasing capacity
+    int batch_depth = 0;
+    ListenerId next_listener_id = 1;
 
-    std::optional<Position> findVisualLine(int line, Node *node);
-    Position findVisualColumn(Node *node, int offset_line_begin, int visual_column);
+    std::optional<Position> findVisualLine(Offset line, Node *node) const;
+    Position findVisualColumn(Node *node, Offset offset_line_begin, Offset visual_column) const;
+    Position findByUnit(Offset value, PositionUnit unit, Metrics &before) const;
+    void insertAfter(Node *anchor, Node *new_node);
+    void insertBefore(Node *anchor, Node *new_node);
     void insertNodeAtPosition(const Position &insert, Node *new_node);
-    void removeStartingFromPosition(const Position &start, int length);
-    static std::vector<const Piece *> getLinePiecesFromPosition(const Position &start);
+    Offset documentOffset(Offset line, Offset column) const;
+    void recordChange(Offset offset, Offset removed_length, Offset removed_line_breaks, Offset inserted_length,
+                      Offset inserted_line_breaks, Offset first_line);
+    void hashPiece(Node *node) const;
+    void hashSplit(Node *left, Node *right, const Hash &whole) const;
+    void extendPiece(Node *node, const Piece &more) const;
+    void rehash(Node *node) const;
+    Hash hashRange(const Node *node, Offset start, Offset end) const;
+    void indexPiece(Node *node) const;
+    static void collectUnindexed(const Node *node, std::vector<Piece> &pieces);
+    static std::vector<std::pair<Offset, Offset>> liveRanges(const Node *node, NodeType type);
+    std::size_t applyIndex(Node *node, std::vector<Piece> &scanned) const;
+    void indexAll(Node *node);
+    Position positionAt(Offset offset) const;
+    bool isPieceBoundary(Offset offset) const;
+    static Offset commonPrefix(const PieceTree &a, const PieceTree &b);
+    static Offset commonSuffix(const PieceTree &a, const PieceTree &b, Offset limit);
+    std::vector<const Piece *> getLinePiecesFromPosition(const Position &start) const;
+
+    static Node *copy(const Node *node, Node *parent, Node *&slot, NodeBlock *block);
+    void checkNode(const Node *node, const Node *parent) const;
+    static Node *build(std::vector<Piece> &pieces, std::size_t begin, std::size_t end, Node *parent,
+                       std::uint32_t band);
+    static Node *detach(Node *node);
+    static Node *join(Node *left, Node *middle, Node *right);
+    static Node *join(Node *left, Node *right);
+    static Node *merge(Node *left, Node *right);
+    std::pair<Node *, Node *> split(Node *node, Offset offset) const;
+    static void destroy(Node *node);
 
   public:
-    void insert(const Piece &new_piece, int insertion_line, int insertion_column);
-    void remove(int line, int column, int length);
-    std::vector<const Piece *> getLinePieces(int line);
+    PieceTree();
+    PieceTree(const PieceTree &) = delete;
+    PieceTree &operator=(const PieceTree &) = delete;
+    PieceTree(PieceTree &&other) noexcept;
+    PieceTree &operator=(PieceTree &&other) noexcept;
+    ~PieceTree();
+
+    // deep copy of the piece sequence, O(n) with the nodes copied into one allocation; markers are not copied.
+    // The text source is shared, so both trees read the same buffers
+    [[nodiscard]] PieceTree clone() const;
+    // balanced tree over pieces in document order, O(n) without rescanning any text
+    static PieceTree fromPieces(std::vector<Piece> pieces);
+
+    void insert(const Piece &new_piece, Offset insertion_line, Offset insertion_column);
+    // inserts at the end of the document without a line lookup. A piece continuing the last one in the same
+    // buffer extends it in place up to append_merge_limit bytes, otherwise it becomes the new rightmost node.
+    // Rebalancing is amortized O(1) per append, the aggregates are refreshed up the right spine
+    void append(const Piece &new_piece);
+    static constexpr Offset append_merge_limit = 1 << 20;
+    void remove(Offset line, Offset column, Offset length);
+    // cut and paste of whole ranges, O(log n) regardless of the range size
+    PieceTree extract(Offset line, Offset column, Offset length);
+    void insertTree(Offset line, Offset column, PieceTree &&other);
+    std::vector<const Piece *> getLinePieces(Offset line) const;
+
+    // conversions between byte, code point and UTF-16 positions, O(log n)
+    Offset convertOffset(Offset offset, PositionUnit from, PositionUnit to) const;
+    Offset convertColumn(Offset line, Offset column, PositionUnit from, PositionUnit to) const;
+    [[nodiscard]] Metrics metrics() const { return root ? root->subtree : Metrics{}; }
+    [[nodiscard]] Offset lineStartOffset(Offset line) const;
+    [[nodiscard]] Offset lineAt(Offset offset) const;
+    // bytes of the longest line without its line ending, O(1); lines inside unindexed pieces are taken as equally long
+    [[nodiscard]] Offset maxLineLength() const;
+    // O(1); line endings inside unindexed pieces are counted once the pieces are scanned
+    [[nodiscard]] LineEndings lineEndings() const { return root ? root->subtree_endings : LineEndings{}; }
+    [[nodiscard]] LineEnding dominantLineEnding() const { return lineEndings().dominant(); }
+
+    // line diff of two versions of one document, i.e. trees whose pieces refer to the same buffers.
+    // Shared pieces are skipped by identity and, with text sources attached, whole runs of them by their
+    // subtree hashes, so the cost follows the edited region. Inside it, pieces shared by both versions
+    // separate the changes into one hunk per run of changed lines, O(m log m) in the pieces between the
+    // first and the last change
+    static std::vector<DiffHunk> diff(const PieceTree &before, const PieceTree &after);
+
+    // O(n) walk verifying links, heights, the balance of the chosen scheme and every cached aggregate against the pieces, throws
+    // PieceTreeException describing the first violation. For tests and debugging
+    void checkInvariants() const;
+
+    // O(n); without the Added buffer size the dead bytes are those below the last referenced one
+    [[nodiscard]] MemoryUsage memoryUsage(std::optional<Offset> added_buffer_size = std::nullopt) const;
+    // releases spare capacity of the piece tables and of the change queue
+    void shrinkToFit();
+    // rewrites added to hold only the bytes pieces refer to and moves the Added pieces along. Only for a
+    // buffer no other tree, clone or extracted range refers to
+    void compactAdded(std::string &added);
+
+    // anchors that follow every insert and remove of this tree
+    MarkerTree &markers();
+
+    // every mutation is reported to the listeners, inside a batch the changes are delivered together
+    // when the outermost batch ends. Listeners must not edit the tree
+    ListenerId subscribe(ChangeListener listener);
+    void unsubscribe(ListenerId id);
+    void beginBatch();
+    void endBatch();
+    static bool isValidUtf8(std::string_view text);
+    // length of the longest prefix of text that does not end inside a UTF-8 character, for text cut from a
+    // longer stream; invalid sequences are not held back
+    static Offset characterBoundary(std::string_view text);
+
+    // Unindexed pieces are scanned when a lookup lands in them, which needs the text source. Line numbers
+    // behind a piece that is still unindexed are approximate, edits resolve them the same way lookups do,
+    // and a line near the end may cease to exist once its chunk is scanned. Indexing changes node metadata from const
+    // lookups, so a tree shared with concurrent readers has to be fully indexed first
+    [[nodiscard]] bool fullyIndexed() const { return metrics().unindexed == 0; }
+    // copies of the unindexed pieces in document order, to be scanned elsewhere, e.g. by LineIndexer
+    [[nodiscard]] std::vector<Piece> unindexedPieces() const;
+    // replaces unindexed pieces by their scanned versions, pieces edited or indexed meanwhile are skipped.
+    // With a text source attached the applied pieces are hashed here. Returns the number of pieces indexed
+    std::size_t applyIndex(std::vector<Piece> scanned);
+    // scans every unindexed piece through the text source now, throws when none is attached
+    void indexAll();
+
+    // content hashes need the text, attaching a source hashes every indexed piece once, edits and indexing keep
+    // it up to date. Hashes are available once the tree is fully indexed
+    void setTextSource(TextSource source);
+    // O(1), equal for equal text regardless of how it is split into pieces
+    [[nodiscard]] std::uint64_t contentHash() const;
+    // hash of the bytes [start, end), O(log n) plus the shorter of the covered and uncovered part of each
+    // partially covered piece at both ends
+    [[nodiscard]] std::uint64_t rangeHash(Offset start, Offset end) const;
+
     Iterator begin() { return Iterator(root); }
     Iterator end() { return Iterator(nullptr); }
 };
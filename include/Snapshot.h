@@ -0,0 +1,56 @@
+#ifndef Snapshot_H
+#define Snapshot_H
+
+#pragma once
+
+#include "PieceTree.h"
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+
+// On-disk image of a document for restoring a session without replaying edits: the Added buffer, the Original
+// file it was opened from and the piece sequence with the line breaks and multibyte characters already
+// scanned. All fields are 64-bit little-endian and 8-byte aligned, the file is mapped and read in place and
+// its payload is protected by a checksum.
+namespace Snapshot {
+// identifies the Original buffer, a snapshot only applies while the file is unchanged
+struct OriginalFile {
+    std::string path;
+    std::uint64_t size = 0;
+    std::int64_t mtime = 0;  // nanoseconds since the epoch
+    std::uint64_t hash = 0;  // PieceTree::Hash of the contents, equal to the content hash of the unedited tree
+
+    // stats path, contents is the text the Original buffer was loaded with
+    static OriginalFile describe(const std::string &path, std::string_view contents);
+    // size and modification time still match the file on disk
+    [[nodiscard]] bool isCurrent() const;
+};
+
+// writes to a temporary file and renames it over path, so a crash leaves the previous snapshot intact
+void save(const std::string &path, PieceTree &tree, std::string_view added, const OriginalFile &original);
+
+// a snapshot mapped into memory, added() points into the mapping and is valid while the object lives
+class Mapped {
+  public:
+    // throws PieceTreeException when the file is not a snapshot, of another version or corrupt
+    explicit Mapped(const std::string &path);
+    Mapped(const Mapped &) = delete;
+    Mapped &operator=(const Mapped &) = delete;
+    ~Mapped();
+
+    [[nodiscard]] const OriginalFile &original() const { return original_file; }
+    [[nodiscard]] std::string_view added() const { return added_buffer; }
+    // O(pieces + line breaks + multibyte chars)
+    [[nodiscard]] PieceTree buildTree() const;
+
+  private:
+    void *mapping = nullptr;
+    std::size_t mapping_size = 0;
+    OriginalFile original_file;
+    std::string_view added_buffer;
+    std::size_t pieces_at = 0; // offset of the piece table in the mapping
+};
+} // namespace Snapshot
+
+#endif // Snapshot_H
@@ -0,0 +1,122 @@
+#include "../include/AsyncLoader.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ThreadPool::ThreadPool(std::size_t threads) {
+    for (std::size_t i = 0; i < threads; i++) {
+        workers.emplace_back([this](std::stop_token stop) {
+            std::unique_lock lock(mutex);
+            while (available.wait(lock, stop, [this] { return !queue.empty(); })) {
+                std::coroutine_handle<> continuation = queue.front();
+                queue.pop_front();
+                lock.unlock();
+                continuation.resume();
+                lock.lock();
+            }
+        });
+    }
+}
+
+// notified under the lock, the last continuation may end the task and with it the executor's lifetime
+void ThreadPool::post(std::coroutine_handle<> continuation) {
+    std::lock_guard lock(mutex);
+    queue.push_back(continuation);
+    available.notify_one();
+}
+
+void OwnerExecutor::post(std::coroutine_handle<> continuation) {
+    std::lock_guard lock(mutex);
+    queue.push_back(continuation);
+    available.notify_one();
+}
+
+std::size_t OwnerExecutor::runPending(std::chrono::milliseconds wait) {
+    std::vector<std::coroutine_handle<>> ready;
+    {
+        std::unique_lock lock(mutex);
+        available.wait_for(lock, wait, [this] { return !queue.empty(); });
+        ready.swap(queue);
+    }
+    for (std::coroutine_handle<> continuation : ready)
+        continuation.resume();
+    return ready.size();
+}
+
+LoadTask::~LoadTask() {
+    if (handle)
+        handle.destroy();
+}
+
+LoadProgress LoadTask::result() const {
+    if (!handle.done())
+        throw PieceTreeException("Loading: the load has not finished");
+    if (handle.promise().error)
+        std::rethrow_exception(handle.promise().error);
+    return handle.promise().progress;
+}
+
+LoadTask openAsync(std::string path, PieceTree &tree, OriginalBuffer &buffer, ThreadPool &pool, OwnerExecutor &owner,
+                   std::stop_token stop, std::function<void(const LoadProgress &)> progress,
+                   PieceTree::Offset chunk_size) {
+    LoadProgress state;
+    std::exception_ptr error;
+    int fd = -1;
+
+    co_await pool;
+    try {
+        fd = ::open(path.c_str(), O_RDONLY);
+        struct stat st {};
+        if (fd < 0 || ::fstat(fd, &st) != 0)
+            throw PieceTreeException("cannot open " + path + ": " + std::strerror(errno));
+        state.total = static_cast<PieceTree::Offset>(st.st_size);
+        // not zero-filled, every byte is read over before a piece refers to it
+        buffer.data = std::make_unique_for_overwrite<char[]>(state.total);
+        buffer.length = state.total;
+
+        while (state.loaded < state.total) {
+            if (stop.stop_requested()) {
+                state.cancelled = true;
+                break;
+            }
+
+            char *chunk = buffer.data.get() + state.loaded;
+            PieceTree::Offset length = std::min(chunk_size, state.total - state.loaded);
+            for (PieceTree::Offset read = 0; read < length;) {
+                ssize_t n = ::pread(fd, chunk + read, length - read, state.loaded + read);
+                if (n < 0 && errno == EINTR)
+                    continue;
+                if (n <= 0)
+                    throw PieceTreeException("cannot read " + path + ": " + std::strerror(n < 0 ? errno : EIO));
+                read += n;
+            }
+            // a chunk that does not end the file is cut before a character it would split
+            PieceTree::Offset boundary = PieceTree::characterBoundary(std::string_view(chunk, length));
+            if (state.loaded + length < state.total && boundary > 0)
+                length = boundary;
+
+            PieceTree::Piece piece =
+                PieceTree::Piece::fromText(NodeType::Original, state.loaded, std::string_view(chunk, length));
+
+            co_await owner;
+            tree.append(piece);
+            state.loaded += length;
+            if (progress)
+                progress(state);
+            co_await pool;
+        }
+    } catch (...) {
+        error = std::current_exception();
+    }
+    if (fd >= 0)
+        ::close(fd);
+
+    // completes on the owner thread, where the task is observed
+    co_await owner;
+    if (error)
+        std::rethrow_exception(error);
+    co_return state;
+}
@@ -0,0 +1,110 @@
+#include "../include/BufferStore.h"
+
+#include <algorithm>
+#include <cstring>
+
+PieceTree SharedBuffer::makeTree() const {
+    if (data.empty())
+        return {};
+    return PieceTree::fromPieces({scanned});
+}
+
+BufferStore &BufferStore::global() {
+    static BufferStore store;
+    return store;
+}
+
+std::shared_ptr<const SharedBuffer> BufferStore::intern(std::string contents) {
+    std::uint64_t hash = PieceTree::Hash::of(contents).value;
+    {
+        std::lock_guard lock(mutex);
+        auto [begin, end] = buffers.equal_range(hash);
+        for (auto it = begin; it != end;) {
+            if (auto buffer = it->second.lock()) {
+                if (buffer->data == contents)
+                    return buffer;
+                ++it;
+            } else {
+                it = buffers.erase(it);
+            }
+        }
+    }
+
+    // scanned outside of the lock, a concurrent intern of the same text is resolved below
+    auto buffer = std::make_shared<SharedBuffer>();
+    buffer->scanned = PieceTree::Piece::fromText(NodeType::Original, 0, contents);
+    // every tree over the buffer refers to these tables, trimmed once here
+    buffer->scanned.line_breaks.shrinkToFit();
+    buffer->scanned.carriage_returns.shrinkToFit();
+    buffer->scanned.multibyte_chars.shrinkToFit();
+    buffer->data = std::move(contents);
+    buffer->content_hash = hash;
+
+    std::lock_guard lock(mutex);
+    auto [begin, end] = buffers.equal_range(hash);
+    for (auto it = begin; it != end; ++it) {
+        if (auto existing = it->second.lock(); existing && existing->data == buffer->data)
+            return existing;
+    }
+    buffers.emplace(hash, buffer);
+    return buffer;
+}
+
+std::size_t BufferStore::size() {
+    std::lock_guard lock(mutex);
+    std::erase_if(buffers, [](const auto &entry) { return entry.second.expired(); });
+    return buffers.size();
+}
+
+std::size_t BufferStore::freeBlocks() {
+    std::lock_guard lock(mutex);
+    return free_blocks.size();
+}
+
+std::unique_ptr<char[]> BufferStore::acquireBlock() {
+    std::lock_guard lock(mutex);
+    if (free_blocks.empty())
+        return std::make_unique_for_overwrite<char[]>(block_size);
+    std::unique_ptr<char[]> block = std::move(free_blocks.back());
+    free_blocks.pop_back();
+    return block;
+}
+
+void BufferStore::releaseBlock(std::unique_ptr<char[]> block) {
+    std::lock_guard lock(mutex);
+    if (free_blocks.size() < max_free_blocks)
+        free_blocks.push_back(std::move(block));
+}
+
+AddedBuffer::~AddedBuffer() {
+    for (Block &block : blocks) {
+        if (block.capacity == BufferStore::block_size)
+            store.releaseBlock(std::move(block.data));
+    }
+}
+
+PieceTree::Piece AddedBuffer::append(std::string_view text) {
+    if (blocks.empty() || blocks.back().capacity - blocks.back().used < text.size()) {
+        // blocks are spaced one offset apart, so pieces from neighbouring blocks never look contiguous to
+        // PieceTree::append, which would merge them across two allocations
+        PieceTree::Offset start = blocks.empty() ? 0 : blocks.back().start + blocks.back().capacity + 1;
+        // text larger than a block gets a block of its own, which is not recycled
+        if (text.size() > BufferStore::block_size)
+            blocks.push_back({start, std::make_unique_for_overwrite<char[]>(text.size()), text.size()});
+        else
+            blocks.push_back({start, store.acquireBlock(), BufferStore::block_size});
+    }
+
+    Block &block = blocks.back();
+    std::memcpy(block.data.get() + block.used, text.data(), text.size());
+    auto offset = static_cast<PieceTree::Offset>(block.start + block.used);
+    block.used += text.size();
+    return PieceTree::Piece::fromText(NodeType::Added, offset, text);
+}
+
+std::string_view AddedBuffer::text(const PieceTree::Piece &piece) const {
+    auto it = std::upper_bound(blocks.begin(), blocks.end(), piece.offset,
+                               [](PieceTree::Offset offset, const Block &block) { return offset < block.start; });
+    const Block &block = *std::prev(it);
+    return {block.data.get() + (piece.offset - block.start), static_cast<std::size_t>(piece.length)};
+}
@@ -0,0 +1,124 @@
+#include "../include/ConcurrentPieceTree.h"
+
+#include <algorithm>
+
+std::size_t EpochManager::registerReader() {
+    for (std::size_t i = 0; i < max_readers; i++) {
+        bool expected = false;
+        if (slots[i].used.compare_exchange_strong(expected, true)) {
+            return i;
+        }
+    }
+    throw PieceTreeException("more than " + std::to_string(max_readers) + " concurrent readers");
+}
+
+void EpochManager::unregisterReader(std::size_t slot) {
+    slots[slot].pins = 0;
+    slots[slot].epoch.store(0);
+    slots[slot].used.store(false);
+}
+
+void EpochManager::pin(std::size_t slot) {
+    // the epoch is published before the reader loads anything it could retire. A nested pin keeps the older
+    // epoch, which protects everything retired since as well
+    if (slots[slot].pins++ == 0)
+        slots[slot].epoch.store(global_epoch.load());
+}
+
+void EpochManager::unpin(std::size_t slot) {
+    if (--slots[slot].pins == 0)
+        slots[slot].epoch.store(0, std::memory_order_release);
+}
+
+std::uint64_t EpochManager::advance() { return global_epoch.fetch_add(1); }
+
+std::uint64_t EpochManager::oldestPinned() const {
+    std::uint64_t oldest = no_pin;
+    for (const Slot &slot : slots) {
+        std::uint64_t epoch = slot.epoch.load();
+        if (epoch != 0)
+            oldest = std::min(oldest, epoch);
+    }
+    return oldest;
+}
+
+ConcurrentPieceTree::Snapshot::Snapshot(EpochManager &epochs, std::size_t slot, const PieceTree *tree)
+    : epochs(epochs), slot(slot), tree(tree) {}
+
+ConcurrentPieceTree::Snapshot::~Snapshot() { epochs.unpin(slot); }
+
+ConcurrentPieceTree::Reader::Reader(const ConcurrentPieceTree &owner, std::size_t slot) : owner(&owner), slot(slot) {}
+
+ConcurrentPieceTree::Reader::Reader(Reader &&other) noexcept
+    : owner(std::exchange(other.owner, nullptr)), slot(other.slot) {}
+
+ConcurrentPieceTree::Reader::~Reader() {
+    if (owner)
+        owner->epochs.unregisterReader(slot);
+}
+
+ConcurrentPieceTree::Snapshot ConcurrentPieceTree::Reader::pin() const {
+    owner->epochs.pin(slot);
+    return {owner->epochs, slot, owner->published.load()};
+}
+
+ConcurrentPieceTree::ConcurrentPieceTree(PieceTree &&initial) : writer_tree(std::move(initial)) {
+    writer_tree.indexAll();
+    published.store(new PieceTree(writer_tree.clone()));
+}
+
+ConcurrentPieceTree::~ConcurrentPieceTree() {
+    // readers must be gone by now, nothing is pinned anymore
+    for (auto &[epoch, tree] : retired) {
+        delete tree;
+    }
+    delete published.load();
+}
+
+ConcurrentPieceTree::Reader ConcurrentPieceTree::reader() { return {*this, epochs.registerReader()}; }
+
+void ConcurrentPieceTree::edit(const std::function<void(PieceTree &)> &change) {
+    std::lock_guard lock(writer_mutex);
+    change(writer_tree);
+    staged = true;
+    publishLocked();
+}
+
+void ConcurrentPieceTree::stage(const std::function<void(PieceTree &)> &change) {
+    std::lock_guard lock(writer_mutex);
+    change(writer_tree);
+    staged = true;
+}
+
+void ConcurrentPieceTree::publish() {
+    std::lock_guard lock(writer_mutex);
+    publishLocked();
+}
+
+// writer_mutex has to be held
+void ConcurrentPieceTree::publishLocked() {
+    if (!staged)
+        return;
+    writer_tree.indexAll();
+    staged = false;
+    const PieceTree *old = published.exchange(new PieceTree(writer_tree.clone()));
+    retired.emplace_back(epochs.advance(), old);
+    reclaim();
+}
+
+std::size_t ConcurrentPieceTree::pendingReclamation() {
+    std::lock_guard lock(writer_mutex);
+    reclaim();
+    return retired.size();
+}
+
+// frees the versions no pinned reader can still see, writer_mutex has to be held
+void ConcurrentPieceTree::reclaim() {
+    std::uint64_t oldest = epochs.oldestPinned();
+    std::erase_if(retired, [&](const std::pair<std::uint64_t, const PieceTree *> &entry) {
+        if (entry.first >= oldest)
+            return false;
+        delete entry.second;
+        return true;
+    });
+}
@@ -0,0 +1,249 @@
+#include "../include/EditLog.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <tuple>
+#include <unistd.h>
+
+namespace EditLog {
+namespace {
+constexpr std::string_view header("PTEDITLOG\x01", 10); // magic and format version
+
+PieceTreeException ioError(const std::string &what, const std::string &path) {
+    return PieceTreeException(what + " " + path + ": " + std::strerror(errno));
+}
+
+void writeAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t written = ::write(fd, data.data(), data.size());
+        if (written < 0) {
+            if (errno == EINTR)
+                continue;
+            throw PieceTreeException(std::string("cannot write edit log: ") + std::strerror(errno));
+        }
+        data.remove_prefix(written);
+    }
+}
+} // namespace
+
+Writer::Writer(const std::string &path, std::size_t commit_threshold) : commit_threshold(commit_threshold) {
+    std::string existing = Reader::readFile(path);
+
+    // a header cut short is the log of a crash before the first commit completed
+    std::size_t valid = 0;
+    if (!existing.empty() && !header.starts_with(existing)) {
+        Reader reader(existing); // throws on a foreign file before it is modified
+        Operation operation{};
+        try {
+            while (reader.next(operation)) {
+            }
+        } catch (const PieceTreeException &) {
+            // an unknown tag is a zero-filled or garbage tail left by a crash, the records before it are kept
+        }
+        valid = reader.consumed();
+    }
+
+    fd = ::open(path.c_str(), O_WRONLY | O_CREAT, 0644);
+    if (fd < 0)
+        throw ioError("cannot open edit log", path);
+    if (::ftruncate(fd, static_cast<off_t>(valid)) != 0 || ::lseek(fd, 0, SEEK_END) < 0) {
+        ::close(fd);
+        throw ioError("cannot truncate edit log", path);
+    }
+    if (valid == 0)
+        buffer.append(header);
+}
+
+Writer::~Writer() {
+    try {
+        commit();
+    } catch (const PieceTreeException &) {
+        // nothing sensible to do while destroying, callers wanting the error commit explicitly
+    }
+    ::close(fd);
+}
+
+void Writer::putVarint(std::uint64_t value) {
+    while (value >= 0x80) {
+        buffer.push_back(static_cast<char>(value | 0x80));
+        value >>= 7;
+    }
+    buffer.push_back(static_cast<char>(value));
+}
+
+void Writer::logInsert(Offset line, Offset column, std::string_view text) {
+    buffer.push_back(static_cast<char>(OperationType::Insert));
+    putVarint(line);
+    putVarint(column);
+    putVarint(text.size());
+    buffer.append(text);
+    if (buffer.size() >= commit_threshold)
+        commit();
+}
+
+void Writer::logRemove(Offset line, Offset column, Offset length) {
+    buffer.push_back(static_cast<char>(OperationType::Remove));
+    putVarint(line);
+    putVarint(column);
+    putVarint(length);
+    if (buffer.size() >= commit_threshold)
+        commit();
+}
+
+void Writer::commit() {
+    if (buffer.empty())
+        return;
+    writeAll(fd, buffer);
+    if (::fdatasync(fd) != 0)
+        throw PieceTreeException(std::string("cannot sync edit log: ") + std::strerror(errno));
+    buffer.clear();
+}
+
+Reader::Reader(std::string_view data) : data(data) {
+    if (data.substr(0, header.size()) != header)
+        throw PieceTreeException("not an edit log or unsupported version");
+    position = header.size();
+}
+
+bool Reader::getVarint(std::size_t &at, std::uint64_t &value) const {
+    value = 0;
+    for (int shift = 0; shift < 64 && at < data.size(); shift += 7) {
+        auto byte = static_cast<std::uint8_t>(data[at++]);
+        value |= static_cast<std::uint64_t>(byte & 0x7f) << shift;
+        if (!(byte & 0x80))
+            return true;
+    }
+    return false;
+}
+
+bool Reader::next(Operation &operation) {
+    std::size_t at = position;
+    if (at >= data.size())
+        return false;
+
+    auto type = static_cast<OperationType>(data[at++]);
+    if (type != OperationType::Insert && type != OperationType::Remove)
+        throw PieceTreeException("corrupt edit log record at byte " + std::to_string(position));
+
+    std::uint64_t line, column, length;
+    if (!getVarint(at, line) || !getVarint(at, column) || !getVarint(at, length))
+        return false;
+
+    std::string_view text;
+    if (type == OperationType::Insert) {
+        if (length > data.size() - at)
+            return false;
+        text = data.substr(at, length);
+        at += length;
+    }
+
+    operation = {type, static_cast<Offset>(line), static_cast<Offset>(column), static_cast<Offset>(length), text};
+    position = at;
+    return true;
+}
+
+std::string Reader::readFile(const std::string &path) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return {};
+    std::ostringstream contents;
+    contents << file.rdbuf();
+    return std::move(contents).str();
+}
+
+namespace {
+// an insert not yet applied to the tree, its text is the tail of the added buffer
+struct PendingInsert {
+    Offset line = 0;
+    Offset column = 0;
+    Offset added_offset = 0;
+    Offset end_line = 0;
+    Offset end_column = 0;
+    bool active = false;
+
+    // moves the end past text just appended, only text itself is scanned
+    void advance(std::string_view text) {
+        std::size_t last_break = text.rfind('\n');
+        if (last_break == std::string_view::npos) {
+            end_column += static_cast<Offset>(text.size());
+            return;
+        }
+        end_line += static_cast<Offset>(std::count(text.begin(), text.end(), '\n'));
+        end_column = static_cast<Offset>(text.size() - last_break - 1);
+    }
+
+    // line and column of the byte at keep of the pending text, scans the removed tail and, when it holds a
+    // line break, the last line left before it
+    std::pair<Offset, Offset> positionBefore(std::string_view text, Offset keep) const {
+        std::string_view removed = text.substr(keep);
+        auto breaks = static_cast<Offset>(std::count(removed.begin(), removed.end(), '\n'));
+        if (breaks == 0)
+            return {end_line, end_column - static_cast<Offset>(removed.size())};
+        std::size_t last_break = text.substr(0, keep).rfind('\n');
+        if (last_break == std::string_view::npos)
+            return {line, column + keep};
+        return {end_line - breaks, keep - static_cast<Offset>(last_break) - 1};
+    }
+};
+} // namespace
+
+std::size_t replay(std::string_view data, PieceTree &tree, std::string &added) {
+    Reader reader(data);
+    Operation operation{};
+    PendingInsert pending;
+    std::size_t count = 0;
+
+    auto flush = [&] {
+        if (!pending.active)
+            return;
+        pending.active = false;
+        std::string_view text = std::string_view(added).substr(pending.added_offset);
+        if (!text.empty())
+            tree.insert(PieceTree::Piece::fromText(NodeType::Added, pending.added_offset, text), pending.line,
+                        pending.column);
+    };
+
+    tree.beginBatch();
+    try {
+        while (reader.next(operation)) {
+            count++;
+            if (operation.type == OperationType::Insert) {
+                if (!pending.active || operation.line != pending.end_line || operation.column != pending.end_column) {
+                    flush();
+                    pending = {operation.line, operation.column, static_cast<Offset>(added.size()),
+                               operation.line, operation.column, true};
+                }
+                added.append(operation.text);
+                pending.advance(operation.text);
+                continue;
+            }
+
+            // backspace over the end of the pending text only shortens it
+            if (pending.active) {
+                auto text = std::string_view(added).substr(pending.added_offset);
+                Offset keep = static_cast<Offset>(text.size()) - operation.length;
+                if (keep >= 0) {
+                    auto start = pending.positionBefore(text, keep);
+                    if (std::pair(operation.line, operation.column) == start) {
+                        added.resize(pending.added_offset + keep);
+                        std::tie(pending.end_line, pending.end_column) = start;
+                        continue;
+                    }
+                }
+            }
+            flush();
+            tree.remove(operation.line, operation.column, operation.length);
+        }
+        flush();
+    } catch (...) {
+        tree.endBatch();
+        throw;
+    }
+    tree.endBatch();
+    return count;
+}
+} // namespace EditLog
@@ -0,0 +1,53 @@
+#include "../include/LineIndexer.h"
+
+LineIndexer::LineIndexer(PieceTree::TextSource source)
+    : source(std::move(source)), worker([this](std::stop_token stop) { run(stop); }) {}
+
+LineIndexer::~LineIndexer() {
+    worker.request_stop();
+    worker.join();
+}
+
+void LineIndexer::run(std::stop_token stop) {
+    std::unique_lock lock(mutex);
+    while (changed.wait(lock, stop, [this] { return !queue.empty(); })) {
+        PieceTree::Piece piece = std::move(queue.front());
+        queue.pop_front();
+        scanning = true;
+
+        lock.unlock();
+        PieceTree::Piece scanned = PieceTree::Piece::fromText(piece.type, piece.offset, source(piece));
+        lock.lock();
+
+        done.push_back(std::move(scanned));
+        scanning = false;
+        changed.notify_all();
+    }
+}
+
+void LineIndexer::schedule(const PieceTree &tree) {
+    std::vector<PieceTree::Piece> pieces = tree.unindexedPieces();
+    std::lock_guard lock(mutex);
+    for (PieceTree::Piece &piece : pieces)
+        queue.push_back(std::move(piece));
+    changed.notify_all();
+}
+
+std::size_t LineIndexer::apply(PieceTree &tree) {
+    std::vector<PieceTree::Piece> scanned;
+    {
+        std::lock_guard lock(mutex);
+        scanned.swap(done);
+    }
+    return scanned.empty() ? 0 : tree.applyIndex(std::move(scanned));
+}
+
+void LineIndexer::wait() {
+    std::unique_lock lock(mutex);
+    changed.wait(lock, [this] { return queue.empty() && !scanning; });
+}
+
+bool LineIndexer::idle() {
+    std::lock_guard lock(mutex);
+    return queue.empty() && !scanning;
+}
@@ -0,0 +1,90 @@
+#include "../include/LogFollower.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+PieceTreeException ioError(const std::string &what, const std::string &path) {
+    return PieceTreeException(what + " " + path + ": " + std::strerror(errno));
+}
+} // namespace
+
+LogFollower::LogFollower(const std::string &path, PieceTree &tree, std::size_t capacity)
+    : path(path), tree(tree), capacity(capacity) {
+    fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        throw ioError("cannot open", path);
+
+    inotify_fd = ::inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (inotify_fd < 0 || ::inotify_add_watch(inotify_fd, path.c_str(), IN_MODIFY) < 0) {
+        PieceTreeException error = ioError("cannot watch", path);
+        if (inotify_fd >= 0)
+            ::close(inotify_fd);
+        ::close(fd);
+        throw error;
+    }
+
+    void *reserved = ::mmap(nullptr, capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (reserved == MAP_FAILED) {
+        PieceTreeException error = ioError("cannot reserve address space for", path);
+        ::close(inotify_fd);
+        ::close(fd);
+        throw error;
+    }
+    base = static_cast<char *>(reserved);
+}
+
+LogFollower::~LogFollower() {
+    ::munmap(base, capacity);
+    ::close(inotify_fd);
+    ::close(fd);
+}
+
+PieceTree::Offset LogFollower::poll() {
+    struct stat st {};
+    if (::fstat(fd, &st) != 0)
+        throw ioError("cannot stat", path);
+    auto size = static_cast<std::size_t>(st.st_size);
+    if (size < static_cast<std::size_t>(appended))
+        throw PieceTreeException("Following: " + path + " was truncated");
+    if (size > capacity)
+        throw PieceTreeException("Following: " + path + " grew beyond the reserved capacity");
+
+    // only the new pages are mapped, over the reservation, so text already appended keeps its address
+    if (size > mapped) {
+        const auto page = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+        std::size_t end = std::min((size + page - 1) / page * page, capacity);
+        if (::mmap(base + mapped, end - mapped, PROT_READ, MAP_SHARED | MAP_FIXED, fd,
+                   static_cast<off_t>(mapped)) == MAP_FAILED)
+            throw ioError("cannot map", path);
+        mapped = end;
+    }
+
+    PieceTree::Offset start = appended;
+    while (static_cast<std::size_t>(appended) < size) {
+        std::string_view fresh(base + appended, std::min<std::size_t>(size - appended, PieceTree::append_merge_limit));
+        PieceTree::Offset length = PieceTree::characterBoundary(fresh);
+        if (length == 0)
+            break;
+        tree.append(PieceTree::Piece::fromText(NodeType::Original, appended, fresh.substr(0, length)));
+        appended += length;
+    }
+    return appended - start;
+}
+
+PieceTree::Offset LogFollower::wait(std::chrono::milliseconds timeout) {
+    pollfd events{inotify_fd, POLLIN, 0};
+    if (::poll(&events, 1, static_cast<int>(timeout.count())) > 0) {
+        // the events only say that something was written, poll() finds out what
+        char buffer[4096];
+        while (::read(inotify_fd, buffer, sizeof buffer) > 0) {
+        }
+    }
+    return poll();
+}
@@ -0,0 +1,285 @@
+#include "../include/MarkerTree.h"
+
+#include <algorithm>
+
+namespace {
+// splitmix64, priorities only need to look random
+std::uint64_t priorityOf(std::uint64_t id) {
+    std::uint64_t z = id + 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return z ^ (z >> 31);
+}
+
+bool growsBefore(MarkerTree::Stickiness s) {
+    return s == MarkerTree::Stickiness::AlwaysGrows || s == MarkerTree::Stickiness::GrowsBefore;
+}
+
+bool growsAfter(MarkerTree::Stickiness s) {
+    return s == MarkerTree::Stickiness::AlwaysGrows || s == MarkerTree::Stickiness::GrowsAfter;
+}
+} // namespace
+
+MarkerTree::~MarkerTree() { destroy(root); }
+
+void MarkerTree::destroy(Node *node) {
+    if (!node)
+        return;
+    destroy(node->left);
+    destroy(node->right);
+    delete node;
+}
+
+void MarkerTree::shift(Node *node, Offset delta) {
+    if (!node)
+        return;
+    node->start += delta;
+    node->end += delta;
+    node->max_end += delta;
+    node->delta += delta;
+}
+
+void MarkerTree::push(Node *node) {
+    if (node->delta != 0) {
+        shift(node->left, node->delta);
+        shift(node->right, node->delta);
+        node->delta = 0;
+    }
+}
+
+// recomputes max_end and relinks the children, node's delta has to be pushed already
+MarkerTree::Node *MarkerTree::update(Node *node) {
+    node->max_end = node->end;
+    if (node->left) {
+        node->left->parent = node;
+        node->max_end = std::max(node->max_end, node->left->max_end);
+    }
+    if (node->right) {
+        node->right->parent = node;
+        node->max_end = std::max(node->max_end, node->right->max_end);
+    }
+    return node;
+}
+
+MarkerTree::Node *MarkerTree::merge(Node *left, Node *right) {
+    if (!left || !right) {
+        Node *node = left ? left : right;
+        if (node)
+            node->parent = nullptr;
+        return node;
+    }
+    if (left->priority > right->priority) {
+        push(left);
+        left->right = merge(left->right, right);
+        left->parent = nullptr;
+        return update(left);
+    }
+    push(right);
+    right->left = merge(left, right->left);
+    right->parent = nullptr;
+    return update(right);
+}
+
+// left part gets starts < key, or <= key if key_goes_left
+std::pair<MarkerTree::Node *, MarkerTree::Node *> MarkerTree::split(Node *node, Offset key, bool key_goes_left) {
+    if (!node)
+        return {nullptr, nullptr};
+
+    push(node);
+    node->parent = nullptr;
+    if (node->start < key || (key_goes_left && node->start == key)) {
+        auto [l, r] = split(node->right, key, key_goes_left);
+        node->right = l;
+        if (r)
+            r->parent = nullptr;
+        return {update(node), r};
+    }
+    auto [l, r] = split(node->left, key, key_goes_left);
+    node->left = r;
+    if (l)
+        l->parent = nullptr;
+    return {l, update(node)};
+}
+
+void MarkerTree::collect(Node *node, std::vector<Node *> &nodes) {
+    if (!node)
+        return;
+    push(node);
+    collect(node->left, nodes);
+    nodes.push_back(node);
+    collect(node->right, nodes);
+}
+
+// nodes have to be sorted by start
+MarkerTree::Node *MarkerTree::build(std::vector<Node *> &nodes) {
+    Node *result = nullptr;
+    for (Node *node : nodes) {
+        node->left = node->right = node->parent = nullptr;
+        result = merge(result, update(node));
+    }
+    return result;
+}
+
+// calls adjust on every node whose end is >= from, then fixes max_end on the way back up
+template <typename F> void MarkerTree::forEndsFrom(Node *node, Offset from, F &&adjust) {
+    if (!node || node->max_end < from)
+        return;
+    push(node);
+    forEndsFrom(node->left, from, adjust);
+    if (node->end >= from)
+        adjust(node);
+    forEndsFrom(node->right, from, adjust);
+    update(node);
+}
+
+MarkerTree::MarkerId MarkerTree::add(Offset start, Offset end, Stickiness stickiness) {
+    if (start < 0 || end < start) {
+        throw PieceTreeException("Marker: invalid range [" + std::to_string(start) + ", " + std::to_string(end) + "]");
+    }
+
+    MarkerId id = next_id++;
+    Node *node = new Node{id, stickiness, start, end, end, 0, priorityOf(id)};
+    by_id[id] = node;
+
+    auto [l, r] = split(root, start, true);
+    root = merge(merge(l, node), r);
+    return id;
+}
+
+bool MarkerTree::erase(MarkerId id) {
+    auto it = by_id.find(id);
+    if (it == by_id.end())
+        return false;
+    Node *node = it->second;
+    by_id.erase(it);
+
+    // pending shifts above the node are pushed down first, so no ancestor delta is lost
+    std::vector<Node *> path;
+    for (Node *n = node->parent; n; n = n->parent) {
+        path.push_back(n);
+    }
+    for (auto a = path.rbegin(); a != path.rend(); ++a) {
+        push(*a);
+    }
+    push(node);
+
+    Node *parent = node->parent;
+    Node *replacement = merge(node->left, node->right);
+    if (replacement)
+        replacement->parent = parent;
+    if (!parent) {
+        root = replacement;
+    } else {
+        if (parent->left == node)
+            parent->left = replacement;
+        else
+            parent->right = replacement;
+        for (Node *n = parent; n; n = n->parent) {
+            update(n);
+        }
+    }
+    delete node;
+    return true;
+}
+
+std::optional<MarkerTree::Marker> MarkerTree::get(MarkerId id) const {
+    auto it = by_id.find(id);
+    if (it == by_id.end())
+        return std::nullopt;
+
+    const Node *node = it->second;
+    Offset delta = 0;
+    for (const Node *n = node->parent; n; n = n->parent) {
+        delta += n->delta;
+    }
+    return Marker{node->id, node->start + delta, node->end + delta, node->stickiness};
+}
+
+void MarkerTree::queryFrom(const Node *node, Offset base, Offset start, Offset end, std::vector<Marker> &out) const {
+    if (!node || node->max_end + base < start)
+        return;
+
+    Offset child_base = base + node->delta;
+    queryFrom(node->left, child_base, start, end, out);
+    if (node->start + base > end)
+        return;
+    if (node->end + base >= start)
+        out.push_back({node->id, node->start + base, node->end + base, node->stickiness});
+    queryFrom(node->right, child_base, start, end, out);
+}
+
+std::vector<MarkerTree::Marker> MarkerTree::query(Offset start, Offset end) const {
+    std::vector<Marker> out;
+    queryFrom(root, 0, start, end, out);
+    return out;
+}
+
+std::vector<MarkerTree::Marker> MarkerTree::markersInRange(const PieceTree &document, Offset first_line,
+                                                           Offset last_line) const {
+    Offset start = document.lineStartOffset(first_line);
+    Offset end = document.lineStartOffset(last_line + 1);
+    // without the line break ending the last line
+    if (last_line < document.metrics().line_breaks)
+        end--;
+    return query(start, end);
+}
+
+void MarkerTree::onInsert(Offset offset, Offset length) {
+    if (!root || length <= 0)
+        return;
+
+    auto [before, rest] = split(root, offset, false);
+    auto [at, after] = split(rest, offset, true);
+
+    shift(after, length);
+
+    // ranges starting before the insertion and reaching it
+    forEndsFrom(before, offset, [&](Node *node) {
+        if (node->end > offset || growsAfter(node->stickiness))
+            node->end += length;
+    });
+
+    // ranges starting exactly at the insertion, stickiness decides per edge
+    std::vector<Node *> touched;
+    collect(at, touched);
+    for (Node *node : touched) {
+        bool stays = growsBefore(node->stickiness);
+        if (node->end > offset || growsAfter(node->stickiness))
+            node->end += length;
+        if (!stays)
+            node->start += length;
+        node->end = std::max(node->end, node->start);
+    }
+    std::stable_sort(touched.begin(), touched.end(), [](const Node *a, const Node *b) { return a->start < b->start; });
+
+    root = merge(merge(before, build(touched)), after);
+}
+
+void MarkerTree::onRemove(Offset offset, Offset length) {
+    if (!root || length <= 0)
+        return;
+    const Offset removed_end = offset + length;
+
+    auto [before, rest] = split(root, offset, false);
+    auto [inside, after] = split(rest, removed_end, true);
+
+    shift(after, -length);
+
+    auto clamp = [&](Offset position) {
+        if (position <= offset)
+            return position;
+        return position <= removed_end ? offset : position - length;
+    };
+
+    forEndsFrom(before, offset + 1, [&](Node *node) { node->end = clamp(node->end); });
+
+    // ranges starting inside the removed text collapse onto its start
+    std::vector<Node *> touched;
+    collect(inside, touched);
+    for (Node *node : touched) {
+        node->start = offset;
+        node->end = clamp(node->end);
+    }
+
+    root = merge(merge(before, build(touched)), after);
+}
@@ -1,10 +1,328 @@
 #include "../include/PieceTree.h"
+#include "../include/MarkerTree.h"
 
+#include <algorithm>
+#include <bit>
+#include <climits>
 #include <optional>
 #include <utility>
 #include <vector>
 
-PieceTree::Piece PieceTree::Piece::splitAt(int split_offset) {
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+constexpr std::uint64_t hash_modulus = (std::uint64_t{1} << 61) - 1;
+constexpr std::uint64_t hash_base = 0x5bd1e9955bd1e995 % hash_modulus;
+
+std::uint64_t mulMod(std::uint64_t a, std::uint64_t b) {
+    unsigned __int128 product = static_cast<unsigned __int128>(a) * b;
+    std::uint64_t r = static_cast<std::uint64_t>(product & hash_modulus) + static_cast<std::uint64_t>(product >> 61);
+    return r >= hash_modulus ? r - hash_modulus : r;
+}
+
+std::uint64_t addMod(std::uint64_t a, std::uint64_t b) {
+    std::uint64_t r = a + b;
+    return r >= hash_modulus ? r - hash_modulus : r;
+}
+
+std::uint64_t subMod(std::uint64_t a, std::uint64_t b) { return a >= b ? a - b : a + hash_modulus - b; }
+
+// the modulus is prime, so a^(m-2) is the inverse of a, powers of the base are never zero
+std::uint64_t inverseMod(std::uint64_t a) {
+    std::uint64_t result = 1;
+    for (std::uint64_t e = hash_modulus - 2; e; e >>= 1, a = mulMod(a, a))
+        if (e & 1)
+            result = mulMod(result, a);
+    return result;
+}
+
+// treap priorities, splitmix64 over a per-thread sequence
+std::uint32_t nextPriority() {
+    thread_local std::uint64_t state = 0;
+    std::uint64_t z = state += 0x9e3779b97f4a7c15;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+    return static_cast<std::uint32_t>((z ^ (z >> 31)) >> 32);
+}
+
+bool isContinuation(unsigned char c) { return (c & 0xC0) == 0x80; }
+
+// decodes the character starting at i, returns the offset of the next one.
+// invalid bytes are treated as a single U+FFFD each, so they count like ASCII and are not recorded
+std::size_t scanChar(std::string_view text, std::size_t i, std::vector<PieceTree::Offset> *line_breaks,
+                     std::vector<PieceTree::Offset> *carriage_returns,
+                     std::vector<PieceTree::MultibyteChar> *multibyte_chars, bool &valid) {
+    auto c = static_cast<unsigned char>(text[i]);
+    if (c < 0x80) {
+        if (c == '\n' && line_breaks)
+            line_breaks->push_back(static_cast<PieceTree::Offset>(i));
+        else if (c == '\r' && carriage_returns)
+            carriage_returns->push_back(static_cast<PieceTree::Offset>(i));
+        return i + 1;
+    }
+
+    std::size_t width = 0;
+    unsigned char second_min = 0x80, second_max = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+        width = 2;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+        width = 3;
+        if (c == 0xE0)
+            second_min = 0xA0; // overlong
+        else if (c == 0xED)
+            second_max = 0x9F; // surrogates
+    } else if (c >= 0xF0 && c <= 0xF4) {
+        width = 4;
+        if (c == 0xF0)
+            second_min = 0x90; // overlong
+        else if (c == 0xF4)
+            second_max = 0x8F; // above U+10FFFF
+    }
+
+    if (width == 0 || i + width > text.size()) {
+        valid = false;
+        return i + 1;
+    }
+    auto second = static_cast<unsigned char>(text[i + 1]);
+    if (second < second_min || second > second_max) {
+        valid = false;
+        return i + 1;
+    }
+    for (std::size_t k = 2; k < width; k++) {
+        if (!isContinuation(static_cast<unsigned char>(text[i + k]))) {
+            valid = false;
+            return i + 1;
+        }
+    }
+
+    if (multibyte_chars)
+        multibyte_chars->push_back({static_cast<PieceTree::Offset>(i), static_cast<std::uint8_t>(width)});
+    return i + width;
+}
+
+// returns false if text is not valid UTF-8; blocks of plain ASCII are handled 16 bytes at a time
+bool scanText(std::string_view text, std::vector<PieceTree::Offset> *line_breaks,
+              std::vector<PieceTree::Offset> *carriage_returns, std::vector<PieceTree::MultibyteChar> *multibyte_chars) {
+    bool valid = true;
+    std::size_t i = 0;
+    const std::size_t n = text.size();
+
+#ifdef __SSE2__
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i carriage_return = _mm_set1_epi8('\r');
+    while (i + 16 <= n) {
+        __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(text.data() + i));
+        auto non_ascii = static_cast<unsigned>(_mm_movemask_epi8(block));
+        if (non_ascii == 0) {
+            auto breaks = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+            while (breaks && line_breaks) {
+                line_breaks->push_back(static_cast<PieceTree::Offset>(i) + __builtin_ctz(breaks));
+                breaks &= breaks - 1;
+            }
+            auto returns = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, carriage_return)));
+            while (returns && carriage_returns) {
+                carriage_returns->push_back(static_cast<PieceTree::Offset>(i) + __builtin_ctz(returns));
+                returns &= returns - 1;
+            }
+            i += 16;
+            continue;
+        }
+        // the last character may run past the block, the next block starts right after it
+        const std::size_t block_end = i + 16;
+        while (i < block_end)
+            i = scanChar(text, i, line_breaks, carriage_returns, multibyte_chars, valid);
+    }
+#endif
+
+    while (i < n)
+        i = scanChar(text, i, line_breaks, carriage_returns, multibyte_chars, valid);
+
+    return valid;
+}
+
+} // namespace
+
+PieceTree::BalanceCounters PieceTree::balance_counters;
+
+PieceTree::Offset PieceTree::Metrics::get(PositionUnit unit) const {
+    switch (unit) {
+    case PositionUnit::Byte:
+        return length;
+    case PositionUnit::CodePoint:
+        return code_points;
+    case PositionUnit::Utf16:
+        return utf16_units;
+    }
+    return length;
+}
+
+PieceTree::Metrics &PieceTree::Metrics::operator+=(const Metrics &other) {
+    length += other.length;
+    line_breaks += other.line_breaks;
+    code_points += other.code_points;
+    utf16_units += other.utf16_units;
+    unindexed += other.unindexed;
+    pieces += other.pieces;
+    return *this;
+}
+
+PieceTree::LineExtent PieceTree::LineExtent::of(const Piece &piece) {
+    if (piece.estimated_line_breaks) {
+        Offset average = piece.length / (*piece.estimated_line_breaks + 1);
+        return {average, average, average, *piece.estimated_line_breaks > 0};
+    }
+    bool ends_with_cr = !piece.carriage_returns.empty() && piece.carriage_returns.back() == piece.length - 1;
+    if (piece.line_breaks.empty())
+        return {piece.length, piece.length, 0, false, ends_with_cr};
+
+    // both tables are sorted, a line loses its last byte when it is the CR of a CR LF
+    auto cr = piece.carriage_returns.begin();
+    auto lineBefore = [&](Offset line_break, Offset start) {
+        cr = std::lower_bound(cr, piece.carriage_returns.end(), line_break - 1);
+        bool crlf = cr != piece.carriage_returns.end() && *cr == line_break - 1 && line_break > start;
+        return line_break - start - (crlf ? 1 : 0);
+    };
+    LineExtent extent{lineBefore(piece.line_breaks.front(), 0), piece.length - piece.line_breaks.back() - 1, 0, true,
+                      ends_with_cr};
+    for (std::size_t i = 1; i < piece.line_breaks.size(); i++)
+        extent.longest = std::max(extent.longest, lineBefore(piece.line_breaks[i], piece.line_breaks[i - 1] + 1));
+    return extent;
+}
+
+// appends right to this run, the lines at the seam join
+PieceTree::LineExtent &PieceTree::LineExtent::operator+=(const LineExtent &right) {
+    // a CR ending this run is the end of a CR LF when right starts with its LF
+    Offset seam_cr = ends_with_cr && right.has_break && right.first == 0 ? 1 : 0;
+    bool right_empty = !right.has_break && right.first == 0;
+    if (!has_break && !right.has_break) {
+        first += right.first;
+        last = first;
+    } else if (!has_break) {
+        first += right.first - seam_cr;
+        last = right.last;
+        longest = right.longest;
+    } else if (!right.has_break) {
+        last += right.first;
+    } else {
+        longest = std::max({longest, right.longest, last + right.first - seam_cr});
+        last = right.last;
+    }
+    has_break = has_break || right.has_break;
+    if (!right_empty)
+        ends_with_cr = right.ends_with_cr;
+    return *this;
+}
+
+PieceTree::LineEndings PieceTree::LineEndings::of(const Piece &piece) {
+    LineEndings endings;
+    endings.empty = piece.length == 0;
+    if (!piece.indexed())
+        return endings;
+
+    // both tables are sorted, a CR pairs with an LF right after it
+    auto lf = piece.line_breaks.begin();
+    for (Offset cr : piece.carriage_returns) {
+        lf = std::lower_bound(lf, piece.line_breaks.end(), cr + 1);
+        if (lf != piece.line_breaks.end() && *lf == cr + 1)
+            endings.crlf++;
+    }
+    endings.lf = static_cast<Offset>(piece.line_breaks.size()) - endings.crlf;
+    endings.cr = static_cast<Offset>(piece.carriage_returns.size()) - endings.crlf;
+    endings.starts_with_lf = !piece.line_breaks.empty() && piece.line_breaks.front() == 0;
+    endings.ends_with_cr = !piece.carriage_returns.empty() && piece.carriage_returns.back() == piece.length - 1;
+    return endings;
+}
+
+// appends right to this run, a CR at the seam followed by an LF is one CR LF
+PieceTree::LineEndings &PieceTree::LineEndings::operator+=(const LineEndings &right) {
+    if (right.empty)
+        return *this;
+    if (empty)
+        return *this = right;
+
+    lf += right.lf;
+    crlf += right.crlf;
+    cr += right.cr;
+    if (ends_with_cr && right.starts_with_lf) {
+        lf--;
+        cr--;
+        crlf++;
+    }
+    ends_with_cr = right.ends_with_cr;
+    return *this;
+}
+
+LineEnding PieceTree::LineEndings::dominant() const {
+    if (lf >= crlf && lf >= cr)
+        return LineEnding::Lf;
+    return crlf >= cr ? LineEnding::CrLf : LineEnding::Cr;
+}
+
+PieceTree::Hash PieceTree::Hash::of(std::string_view text) {
+    Hash h;
+    for (char c : text) {
+        // +1 so that zero bytes still change the value
+        h.value = addMod(mulMod(h.value, hash_base), static_cast<unsigned char>(c) + 1);
+        h.power = mulMod(h.power, hash_base);
+    }
+    return h;
+}
+
+PieceTree::Hash &PieceTree::Hash::operator+=(const Hash &right) {
+    value = addMod(mulMod(value, right.power), right.value);
+    power = mulMod(power, right.power);
+    return *this;
+}
+
+// whole = prefix * base^|suffix| + suffix
+PieceTree::Hash PieceTree::Hash::withoutPrefix(const Hash &prefix) const {
+    Hash suffix;
+    suffix.power = mulMod(power, inverseMod(prefix.power));
+    suffix.value = subMod(value, mulMod(prefix.value, suffix.power));
+    return suffix;
+}
+
+PieceTree::Hash PieceTree::Hash::withoutSuffix(const Hash &suffix) const {
+    std::uint64_t inverse = inverseMod(suffix.power);
+    return {mulMod(subMod(value, suffix.value), inverse), mulMod(power, inverse)};
+}
+
+PieceTree::Piece PieceTree::Piece::fromText(NodeType type, Offset offset, std::string_view text) {
+    Piece p{type, offset, static_cast<Offset>(text.size()), {}, {}};
+    std::vector<Offset> line_breaks, carriage_returns;
+    std::vector<MultibyteChar> multibyte_chars;
+    scanText(text, &line_breaks, &carriage_returns, &multibyte_chars);
+    p.line_breaks = std::move(line_breaks);
+    p.carriage_returns = std::move(carriage_returns);
+    p.multibyte_chars = std::move(multibyte_chars);
+    p.countMultibyte();
+    return p;
+}
+
+PieceTree::Piece PieceTree::Piece::unindexed(NodeType type, Offset offset, Offset length,
+                                             Offset estimated_line_breaks) {
+    return {type, offset, length, {}, {}, estimated_line_breaks};
+}
+
+bool PieceTree::isValidUtf8(std::string_view text) { return scanText(text, nullptr, nullptr, nullptr); }
+
+PieceTree::Offset PieceTree::characterBoundary(std::string_view text) {
+    auto length = static_cast<Offset>(text.size());
+    Offset lead = length;
+    for (int i = 0; i < 3 && lead > 0 && isContinuation(static_cast<unsigned char>(text[lead - 1])); i++)
+        lead--;
+    if (lead == 0)
+        return length;
+
+    auto byte = static_cast<unsigned char>(text[lead - 1]);
+    Offset width = byte >= 0xf0 ? 4 : byte >= 0xe0 ? 3 : byte >= 0xc0 ? 2 : 1;
+    return length - (lead - 1) < width ? lead - 1 : length;
+}
+
+PieceTree::Piece PieceTree::Piece::splitAt(Offset split_offset) {
     PieceTree::Piece r;
     r.type = type;
 
@@ -12,9 +330,10 @@ PieceTree::Piece PieceTree::Piece::splitAt(int split_offset) {
         // Right gets everything, left becomes empty
         r.offset = offset;
         r.length = length;
-        r.line_breaks = line_breaks;
+        r.line_breaks = std::move(line_breaks);
+        r.multibyte_chars = std::move(multibyte_chars);
+        r.carriage_returns = std::move(carriage_returns);
         length = 0;
-        line_breaks.clear();
         return r;
     }
 
@@ -30,26 +349,47 @@ PieceTree::Piece PieceTree::Piece::splitAt(int split_offset) {
     r.length = length - split_offset;
     length = split_offset;
 
-    int resizeIndex = -1;
-    for (int i = 0; i < line_breaks.size(); i++) {
-        if (line_breaks[i] >= split_offset) {
-            if (resizeIndex == -1)
-                resizeIndex = i;
-            r.line_breaks.push_back(line_breaks[i] - split_offset);
-        }
+    auto lf_split = std::lower_bound(line_breaks.begin(), line_breaks.end(), split_offset);
+    std::vector<Offset> right_line_breaks;
+    for (auto it = lf_split; it != line_breaks.end(); ++it)
+        right_line_breaks.push_back(*it - split_offset);
+    if (lf_split != line_breaks.end()) {
+        auto kept = static_cast<std::size_t>(lf_split - line_breaks.begin());
+        line_breaks.edit().resize(kept);
+    }
+    r.line_breaks = std::move(right_line_breaks);
+
+    auto mb_split = std::lower_bound(multibyte_chars.begin(), multibyte_chars.end(), split_offset,
+                                     [](const MultibyteChar &ch, Offset off) { return ch.offset < off; });
+    std::vector<MultibyteChar> right_multibyte;
+    for (auto it = mb_split; it != multibyte_chars.end(); ++it)
+        right_multibyte.push_back({it->offset - split_offset, it->width});
+    if (mb_split != multibyte_chars.end()) {
+        auto kept = static_cast<std::size_t>(mb_split - multibyte_chars.begin());
+        multibyte_chars.edit().resize(kept);
     }
-    if (resizeIndex != -1)
-        line_breaks.resize(resizeIndex);
+    r.multibyte_chars = std::move(right_multibyte);
+    r.countMultibyte();
+
+    auto cr_split = std::lower_bound(carriage_returns.begin(), carriage_returns.end(), split_offset);
+    std::vector<Offset> right_carriage_returns;
+    for (auto it = cr_split; it != carriage_returns.end(); ++it)
+        right_carriage_returns.push_back(*it - split_offset);
+    if (cr_split != carriage_returns.end()) {
+        auto kept = static_cast<std::size_t>(cr_split - carriage_returns.begin());
+        carriage_returns.edit().resize(kept);
+    }
+    r.carriage_returns = std::move(right_carriage_returns);
 
     return r;
 }
 
-int PieceTree::Piece::getLine(int piece_offset) {
+PieceTree::Offset PieceTree::Piece::getLine(Offset piece_offset) {
     if (line_breaks.empty())
         return 0;
 
-    int line = 0;
-    for (int i = 0; i < line_breaks.size(); i++) {
+    Offset line = 0;
+    for (Offset i = 0; i < line_breaks.size(); i++) {
         if (line_breaks[i] >= piece_offset) {
             return i;
         }
@@ -57,44 +397,173 @@ int PieceTree::Piece::getLine(int piece_offset) {
     return line_breaks.size();
 }
 
-void PieceTree::Piece::cutRightSide(int cut_offset) {
-    // including cut_offset
-    length = cut_offset != 0 ? cut_offset : 1;
-    for (int i = 0; i < line_breaks.size(); i++) {
-        if (line_breaks[i] > length) {
-            int new_size = i;
-            line_breaks.resize(new_size);
-            break;
-        }
+PieceTree::Metrics PieceTree::Piece::metricsBefore(Offset piece_offset) const {
+    Metrics m;
+    m.length = piece_offset;
+    if (estimated_line_breaks) {
+        // line breaks spread evenly over text counted as ASCII
+        m.line_breaks = piece_offset >= length ? *estimated_line_breaks
+                                               : static_cast<Offset>(static_cast<double>(*estimated_line_breaks) *
+                                                                     piece_offset / length);
+        m.code_points = piece_offset;
+        m.utf16_units = piece_offset;
+        return m;
     }
+    m.line_breaks = static_cast<Offset>(std::lower_bound(line_breaks.begin(), line_breaks.end(), piece_offset) -
+                                     line_breaks.begin());
+
+    // the last character starting before piece_offset, it may be cut by it
+    auto next = std::lower_bound(multibyte_chars.begin(), multibyte_chars.end(), piece_offset,
+                                 [](const MultibyteChar &ch, Offset off) { return ch.offset < off; });
+    Offset extra_bytes = 0;
+    Offset surrogate_pairs = 0;
+    if (next != multibyte_chars.begin()) {
+        const MultibyteChar &ch = *std::prev(next);
+        Offset bytes_in = std::min<Offset>(ch.width, piece_offset - ch.offset);
+        extra_bytes = ch.extra_bytes_before + bytes_in - 1;
+        surrogate_pairs = ch.surrogate_pairs_before + (ch.width == 4 && bytes_in == 4 ? 1 : 0);
+    }
+    m.code_points = piece_offset - extra_bytes;
+    m.utf16_units = m.code_points + surrogate_pairs;
+    return m;
 }
 
-void PieceTree::Piece::cutLeftSide(int cut_offset) {
-    // including offset
-    offset += cut_offset;
-    length -= cut_offset;
+// maps a position given in unit to the byte offset inside the piece,
+// a position that falls inside a surrogate pair resolves to the start of its character
+PieceTree::Offset PieceTree::Piece::byteOffsetOf(Offset value, PositionUnit unit) const {
+    if (unit == PositionUnit::Byte)
+        return value;
+
+    // position of the first unit of a character, strictly increasing over the table
+    auto unitsBefore = [unit](const MultibyteChar &ch) {
+        return ch.offset - ch.extra_bytes_before + (unit == PositionUnit::Utf16 ? ch.surrogate_pairs_before : 0);
+    };
+    auto next = std::upper_bound(multibyte_chars.begin(), multibyte_chars.end(), value,
+                                 [&](Offset v, const MultibyteChar &ch) { return v < unitsBefore(ch); });
+    if (next == multibyte_chars.begin())
+        return std::min(value, length);
+
+    const MultibyteChar &ch = *std::prev(next);
+    Offset units = unitsBefore(ch);
+    Offset char_units = unit == PositionUnit::Utf16 && ch.width == 4 ? 2 : 1;
+    if (value < units + char_units)
+        return ch.offset;
+    return std::min(ch.offset + ch.width + (value - units - char_units), length);
+}
 
-    line_breaks.erase(std::remove_if(line_breaks.begin(), line_breaks.end(), [&](int br) { return br < cut_offset; }),
-                      line_breaks.end());
+void PieceTree::Piece::countMultibyte(std::size_t from) {
+    if (from >= multibyte_chars.size())
+        return;
+    std::vector<MultibyteChar> &chars = multibyte_chars.edit();
+    for (std::size_t i = std::max<std::size_t>(from, 1); i < chars.size(); i++) {
+        const MultibyteChar &previous = chars[i - 1];
+        chars[i].extra_bytes_before = previous.extra_bytes_before + previous.width - 1;
+        chars[i].surrogate_pairs_before = previous.surrogate_pairs_before + (previous.width == 4 ? 1 : 0);
+    }
+    if (from == 0)
+        chars[0].extra_bytes_before = chars[0].surrogate_pairs_before = 0;
+}
 
-    for (int &br : line_breaks) {
-        br -= cut_offset;
+// the nodes are placed behind the header, rounded up to their alignment
+static constexpr std::size_t blockHeaderSize(std::size_t header, std::size_t alignment) {
+    return (header + alignment - 1) / alignment * alignment;
+}
+
+PieceTree::NodeBlock *PieceTree::NodeBlock::allocate(std::size_t count) {
+    void *memory = ::operator new(blockHeaderSize(sizeof(NodeBlock), alignof(Node)) + count * sizeof(Node));
+    return new (memory) NodeBlock{count};
+}
+
+PieceTree::Node *PieceTree::NodeBlock::nodes() {
+    return reinterpret_cast<Node *>(reinterpret_cast<char *>(this) + blockHeaderSize(sizeof(NodeBlock), alignof(Node)));
+}
+
+void PieceTree::Node::operator delete(Node *node, std::destroying_delete_t) {
+    NodeBlock *block = node->block;
+    node->~Node();
+    if (!block) {
+        ::operator delete(node);
+    } else if (block->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        block->~NodeBlock();
+        ::operator delete(block);
     }
 }
 
-PieceTree::Node::Node(const Piece &p_) : piece(p_) {}
-PieceTree::Node::Node(Piece &&p_) : piece(std::move(p_)) {}
+PieceTree::Node::Node(const Piece &p_) : piece(p_) {
+    if constexpr (balance == Balance::Treap)
+        priority = nextPriority();
+    pieceChanged();
+}
+
+PieceTree::Node::Node(Piece &&p_) : piece(std::move(p_)) {
+    if constexpr (balance == Balance::Treap)
+        priority = nextPriority();
+    pieceChanged();
+}
+
+// has to be called after piece was modified, the ancestors are not touched
+void PieceTree::Node::pieceChanged() {
+    own = piece.metricsBefore(piece.length);
+    own.unindexed = piece.indexed() ? 0 : 1;
+    own.pieces = 1;
+    own_extent = LineExtent::of(piece);
+    own_endings = LineEndings::of(piece);
+    recalcMetadata();
+}
 
 int PieceTree::Node::recalcMetadata() {
+    if constexpr (counting)
+        balance_counters.updates++;
     int lh = left ? left->height : 0;
     int rh = right ? right->height : 0;
     height = 1 + std::max(lh, rh);
 
-    left_line_count = left ? left->left_line_count + left->piece.line_breaks.size() : 0;
+    left_line_count = left ? left->subtree.line_breaks : 0;
+
+    subtree = own;
+    if (left)
+        subtree += left->subtree;
+    if (right)
+        subtree += right->subtree;
+
+    subtree_hash = left ? left->subtree_hash : Hash{};
+    subtree_hash += own_hash;
+    if (right)
+        subtree_hash += right->subtree_hash;
+
+    subtree_extent = left ? left->subtree_extent : LineExtent{};
+    subtree_extent += own_extent;
+    if (right)
+        subtree_extent += right->subtree_extent;
+
+    subtree_endings = left ? left->subtree_endings : LineEndings{};
+    subtree_endings += own_endings;
+    if (right)
+        subtree_endings += right->subtree_endings;
 
     return height;
 }
 
+// refreshes metadata on the path to the root without rebalancing, used when only a piece shrank or grew
+void PieceTree::Node::updateToRoot() {
+    for (Node *node = this; node; node = node->parent) {
+        node->recalcMetadata();
+    }
+}
+
+// metrics of everything in the document before this node's piece
+PieceTree::Metrics PieceTree::Node::prefixMetrics() {
+    Metrics m = left ? left->subtree : Metrics{};
+    for (Node *cur = this; cur->parent; cur = cur->parent) {
+        if (cur->parent->right == cur) {
+            m += cur->parent->own;
+            if (cur->parent->left)
+                m += cur->parent->left->subtree;
+        }
+    }
+    return m;
+}
+
 int PieceTree::Node::bf() {
     int lh = left ? left->height : 0;
     int rh = right ? right->height : 0;
@@ -102,6 +571,8 @@ int PieceTree::Node::bf() {
 }
 
 PieceTree::Node *PieceTree::Node::rightRotation() {
+    if constexpr (counting)
+        balance_counters.rotations++;
     Node *current = this;
     Node *new_node = left;
 
@@ -128,6 +599,8 @@ PieceTree::Node *PieceTree::Node::rightRotation() {
 }
 
 PieceTree::Node *PieceTree::Node::leftRotation() {
+    if constexpr (counting)
+        balance_counters.rotations++;
     Node *current = this;
     Node *new_node = right;
 
@@ -153,19 +626,6 @@ PieceTree::Node *PieceTree::Node::leftRotation() {
     return new_node;
 }
 
-PieceTree::Node PieceTree::Node::splitAt(int split_offset) {
-    Node r(piece.splitAt(split_offset));
-    r.height = height;
-    r.parent = parent;
-    r.right = right;
-    right = nullptr;
-
-    this->recalcMetadata();
-    r.recalcMetadata();
-
-    return r;
-}
-
 PieceTree::Node *PieceTree::Node::next() {
     if (right != nullptr) {
         return right->leftest();
@@ -214,77 +674,57 @@ PieceTree::Node *PieceTree::Node::rightest() {
     return node;
 }
 
-PieceTree::Node *PieceTree::Node::remove(PieceTree::Node *&root) {
-    PieceTree::Node *head = nullptr;
-    if (right) {
-        head = right;
-        if (parent && parent->left == this) {
-            parent->left = head;
-            head->parent = parent;
-        } else if (parent && parent->right == this) {
-            parent->right = head;
-            head->parent = parent;
-        } else {
-            head->parent = nullptr;
-        }
-        if (left) {
-            auto *head_leftest = head->leftest();
-            head_leftest->left = left;
-            left->parent = head_leftest;
-            root = head_leftest->balanceAndUpdate();
-        }
-    } else if (left) {
-        head = left;
-        if (parent && parent->left == this) {
-            parent->left = head;
-            head->parent = parent;
-            root = head->parent->balanceAndUpdate();
-        } else if (parent && parent->right == this) {
-            parent->right = head;
-            head->parent = parent;
-            root = head->parent->balanceAndUpdate();
-        } else {
-            head->parent = nullptr;
-        }
-    } else {
-        if (parent && parent->left == this) {
-            parent->left = nullptr;
-            root = parent->balanceAndUpdate();
-        } else if (parent && parent->right == this) {
-            parent->right = nullptr;
-            root = parent->balanceAndUpdate();
-        }
-    }
-
-    delete this;
-
-    return head;
-}
-
-std::optional<PieceTree::Position> PieceTree::findVisualLine(int line, Node *node) {
+std::optional<PieceTree::Position> PieceTree::findVisualLine(Offset line, Node *node) const {
     if (!node) {
         return std::nullopt;
     }
 
-    int line_sum_subtree = node->piece.line_breaks.size() + node->left_line_count;
+    const Offset wanted_line = line;
+    Node *const top = node;
+    // scanning a piece changes the counts the descent went by, the search then starts over from the top
+    auto restart = [&] {
+        node = top;
+        line = wanted_line;
+        return node->own.line_breaks + node->left_line_count;
+    };
+    Offset line_sum_subtree = restart();
     while (true) {
         if (node->left_line_count <= line && line <= line_sum_subtree) {
-            int line_in_node = line - node->left_line_count;
+            // the line breaks of the piece are needed from here on, scanning it corrects the counts above
+            if (!node->piece.indexed()) {
+                indexPiece(node);
+                line_sum_subtree = restart();
+                continue;
+            }
+            Offset line_in_node = line - node->left_line_count;
+            bool rescanned = false;
             if (line_in_node == 0) {
                 // searching the start of the line
                 do {
                     Node *temp = node->prev();
                     if (!temp)
                         break;
+                    if (!temp->piece.indexed()) {
+                        indexPiece(temp);
+                        rescanned = true;
+                        break;
+                    }
                     node = temp;
                     line_in_node = node->piece.line_breaks.size();
                 } while (node->piece.line_breaks.empty());
             }
-            int piece_offset = line_in_node != 0 ? node->piece.line_breaks[line_in_node - 1] + 1 : 0;
+            if (rescanned) {
+                line_sum_subtree = restart();
+                continue;
+            }
+            Offset piece_offset = line_in_node != 0 ? node->piece.line_breaks[line_in_node - 1] + 1 : 0;
             // edge case, when node has '\n' as the last character, so the beginning of the line is in the next node;
+            // at the end of the document the line begins right after the last piece
             if (piece_offset >= node->piece.length) {
-                node = node->next();
-                piece_offset = 0;
+                if (Node *next = node->next()) {
+                    node = next;
+                    piece_offset = 0;
+                }
             }
             return Position{node, piece_offset};
         }
@@ -293,23 +733,23 @@ std::optional<PieceTree::Position> PieceTree::findVisualLine(int line, Node *nod
             node = node->right;
             if (!node)
                 break;
-            line_sum_subtree = node->piece.line_breaks.size() + node->left_line_count;
+            line_sum_subtree = node->own.line_breaks + node->left_line_count;
         } else {
             node = node->left;
             if (!node)
                 break;
-            line_sum_subtree = node->piece.line_breaks.size() + node->left_line_count;
+            line_sum_subtree = node->own.line_breaks + node->left_line_count;
         }
     }
 
     return std::nullopt;
 }
 
-PieceTree::Position PieceTree::findVisualColumn(Node *node, int offset_line_begin, int visual_column) {
-    int piece_line = node->piece.getLine(offset_line_begin);
-    int piece_offset = offset_line_begin + visual_column;
+PieceTree::Position PieceTree::findVisualColumn(Node *node, Offset offset_line_begin, Offset visual_column) const {
+    Offset piece_line = node->piece.getLine(offset_line_begin);
+    Offset piece_offset = offset_line_begin + visual_column;
 
-    if (piece_line < node->piece.line_breaks.size() && piece_offset >= node->piece.line_breaks[piece_line]) {
+    if (piece_line < node->piece.line_breaks.size() && piece_offset > node->piece.line_breaks[piece_line]) {
         throw PieceTreeException("insertion column " + std::to_string(visual_column) + " is out of line bounds");
     }
 
@@ -320,8 +760,10 @@ PieceTree::Position PieceTree::findVisualColumn(Node *node, int offset_line_begi
         if (!node) {
             throw PieceTreeException("insertion column " + std::to_string(visual_column) + " beyond document length");
         }
+        if (!node->piece.indexed())
+            indexPiece(node);
 
-        if (!node->piece.line_breaks.empty() && piece_offset >= node->piece.line_breaks[0]) {
+        if (!node->piece.line_breaks.empty() && piece_offset > node->piece.line_breaks[0]) {
             throw PieceTreeException("insertion column " + std::to_string(visual_column) + " is out of line bounds");
         }
     }
@@ -329,107 +771,106 @@ PieceTree::Position PieceTree::findVisualColumn(Node *node, int offset_line_begi
     return {node, piece_offset};
 }
 
+// new_node becomes the in-order successor of anchor, it is always attached as a leaf
+void PieceTree::insertAfter(Node *anchor, Node *new_node) {
+    if (!anchor->right) {
+        anchor->right = new_node;
+        new_node->parent = anchor;
+    } else {
+        Node *successor = anchor->right->leftest();
+        successor->left = new_node;
+        new_node->parent = successor;
+    }
+    root = new_node->balanceAndUpdate();
+}
+
+// new_node becomes the in-order predecessor of anchor, it is always attached as a leaf
+void PieceTree::insertBefore(Node *anchor, Node *new_node) {
+    if (!anchor->left) {
+        anchor->left = new_node;
+        new_node->parent = anchor;
+    } else {
+        Node *predecessor = anchor->left->rightest();
+        predecessor->right = new_node;
+        new_node->parent = predecessor;
+    }
+    root = new_node->balanceAndUpdate();
+}
+
 void PieceTree::insertNodeAtPosition(const Position &insert, Node *new_node) {
     Node *insert_node = insert.node;
-    Node *insert_node_parent = insert_node->parent;
 
     if (insert.piece_offset == 0) {
         // Insert before the target node
-        if (insert_node_parent) {
-            if (insert_node_parent->left == insert_node)
-                insert_node_parent->left = new_node;
-            else
-                insert_node_parent->right = new_node;
-        } else {
-            root = new_node;
-        }
-
-        new_node->parent = insert_node_parent;
-        new_node->right = insert_node;
-        new_node->left = insert_node->left;
-        if (new_node->left)
-            new_node->left->parent = new_node;
-
-        insert_node->left = nullptr;
-        insert_node->parent = new_node;
+        insertBefore(insert_node, new_node);
     } else if (insert.piece_offset >= insert_node->piece.length) {
         // Insert after the target
-        if (insert_node_parent) {
-            if (insert_node_parent->left == insert_node)
-                insert_node_parent->left = new_node;
-            else
-                insert_node_parent->right = new_node;
-        } else {
-            root = new_node;
-        }
-
-        new_node->parent = insert_node_parent;
-        new_node->left = insert_node;
-        new_node->right = insert_node->right;
-        if (new_node->right)
-            new_node->right->parent = new_node;
-
-        insert_node->right = nullptr;
-        insert_node->parent = new_node;
+        insertAfter(insert_node, new_node);
     } else {
         // split target
-        Piece right_piece = insert_node->piece.splitAt(insert.piece_offset);
-        Node *right_node = new Node(right_piece);
-
-        if (insert_node_parent) {
-            if (insert_node_parent->left == insert_node)
-                insert_node_parent->left = new_node;
-            else
-                insert_node_parent->right = new_node;
-        } else {
-            root = new_node;
-        }
-
-        new_node->parent = insert_node_parent;
-        new_node->left = insert_node;
-        new_node->right = right_node;
-        insert_node->parent = new_node;
-        right_node->parent = new_node;
+        Node *right_node = new Node(insert_node->piece.splitAt(insert.piece_offset));
+        Hash whole = insert_node->own_hash;
+        insert_node->pieceChanged();
+        hashSplit(insert_node, right_node, whole);
+        insertAfter(insert_node, new_node);
+        insertAfter(new_node, right_node);
     }
-    new_node->recalcMetadata();
-    if (new_node->parent)
-        new_node->parent->recalcMetadata();
 }
 
+// restores balance and metadata from this node up to the root and returns the root. A subtree whose height did
+// not change leaves the balance of its ancestors as it was, above it only the aggregates are refreshed
 PieceTree::Node *PieceTree::Node::balanceAndUpdate() {
-    auto node = this;
-    node->recalcMetadata();
-
-    if (node->bf() < -1) {
-        if (node->right->bf() == 1) {
-            node = node->rightRotation();
-        }
-        node = node->leftRotation();
-    } else if (node->bf() > 1) {
-        if (node->left->bf() == -1) {
-            node->left = node->leftRotation();
+    if constexpr (balance == Balance::Treap) {
+        // the node rises above ancestors of lower priority, the rotations refresh the nodes they move
+        Node *node = this;
+        node->recalcMetadata();
+        while (node->parent && node->parent->priority < node->priority)
+            node = node->parent->left == node ? node->parent->rightRotation() : node->parent->leftRotation();
+        while (node->parent) {
+            node = node->parent;
+            node->recalcMetadata();
         }
-        node = node->rightRotation();
+        return node;
     }
 
-    node->recalcMetadata();
+    Node *node = this;
+    // the height stored in this node may predate its children, e.g. for a new leaf or the middle of a join
+    bool balancing = true, first = true;
+    while (true) {
+        if (balancing) {
+            if constexpr (counting)
+                balance_counters.balance_checks++;
+            int old_height = node->height;
+            node->recalcMetadata();
+            if (node->bf() < -1) {
+                if (node->right->bf() > 0)
+                    node->right->rightRotation();
+                node = node->leftRotation();
+            } else if (node->bf() > 1) {
+                if (node->left->bf() < 0)
+                    node->left->leftRotation();
+                node = node->rightRotation();
+            }
+            balancing = first || node->height != old_height;
+            first = false;
+        } else {
+            node->recalcMetadata();
+        }
 
-    if (node->parent != nullptr) {
-        return node->parent->balanceAndUpdate();
+        if (!node->parent)
+            return node;
+        node = node->parent;
     }
+}
 
-    // new root
-    return node;
-};
-
-std::vector<const PieceTree::Piece*> PieceTree::getLinePiecesFromPosition(const Position &start){
+std::vector<const PieceTree::Piece*> PieceTree::getLinePiecesFromPosition(const Position &start) const {
     std::vector<const Piece*> pieces;
     Node* current = start.node;
 
     pieces.push_back(&current->piece);
 
     bool end_line_in_piece = false;
-    for (int br : current->piece.line_breaks) {
+    for (Offset br : current->piece.line_breaks) {
         if (br > start.piece_offset) {
             end_line_in_piece = true;
             break;
@@ -439,6 +880,8 @@ std::vector<const PieceTree::Piece*> PieceTree::getLinePiecesFromPosition(const
     while (!end_line_in_piece) {
         current = current->next();
         if (!current) break;
+        if (!current->piece.indexed())
+            indexPiece(current);
 
         pieces.push_back(&current->piece);
         if (!current->piece.line_breaks.empty()) {
@@ -449,79 +892,264 @@ std::vector<const PieceTree::Piece*> PieceTree::getLinePiecesFromPosition(const
     return pieces;
 }
 
-void PieceTree::removeStartingFromPosition(const Position &start, int cut_length) {
-    if (!start.node) {
-        throw PieceTreeException("The node of the starting removal position is nullptr");
+// absolute byte offset of a line/column position, validated like an insertion position
+PieceTree::Offset PieceTree::documentOffset(Offset line, Offset column) const {
+    std::optional<Position> result = findVisualLine(line, root);
+    if (!result) {
+        throw PieceTreeException("line " + std::to_string(line) + " not found in piece table");
     }
-    Node *r_node = start.node;
-    int r_piece_offset = start.piece_offset;
+    Position pos = findVisualColumn(result->node, result->piece_offset, column);
+    return pos.node->prefixMetrics().length + pos.piece_offset;
+}
 
-    while (cut_length > 0) {
-        if (r_piece_offset > 0) {
-            if (r_piece_offset + cut_length < r_node->piece.length) {
-                // inside the node, need to split
-                Piece right_piece = r_node->piece.splitAt(r_piece_offset + cut_length);
-                Node *right_node = new Node(right_piece);
+// copies the subtree including the cached metadata to consecutive slots of block in preorder, nothing is
+// recalculated
+PieceTree::Node *PieceTree::copy(const Node *node, Node *parent, Node *&slot, NodeBlock *block) {
+    if (!node)
+        return nullptr;
+
+    Node *n = new (slot++) Node(*node);
+    n->block = block;
+    n->parent = parent;
+    n->left = copy(node->left, n, slot, block);
+    n->right = copy(node->right, n, slot, block);
+    return n;
+}
 
-                if (r_node->right) {
-                    right_node->right = r_node->right;
-                    r_node->right->parent = right_node;
-                }
-                r_node->right = right_node;
-                right_node->parent = r_node;
-                right_node->balanceAndUpdate();
-
-                // cutting removal_node
-                r_node->piece.length = r_piece_offset;
-                cut_length = 0;
-            } else if (r_piece_offset + cut_length >= r_node->piece.length) {
-                // cut the whole right side
-                int old_piece_length = r_node->piece.length;
-                r_node->piece.cutRightSide(r_piece_offset);
-                cut_length -= old_piece_length - r_node->piece.length;
-
-                if (cut_length > 0) {
-                    auto *temp = r_node->next();
-                    if (!temp) {
-                        throw PieceTreeException(
-                            "The length of the cutout is greater than the length of the WHOLE text");
-                    }
-                    r_node = temp;
-                    r_piece_offset = 0;
-                }
-            }
-        } else if (r_piece_offset == 0) {
-            if (r_piece_offset + cut_length < r_node->piece.length) {
-                // cut left side
-                int old_piece_length = r_node->piece.length;
-                r_node->piece.cutLeftSide(r_piece_offset + cut_length);
-                cut_length -= old_piece_length - r_node->piece.length;
-            } else if (r_piece_offset + cut_length >= r_node->piece.length) {
-                // remove the hole node
-                cut_length -= r_node->piece.length;
-                if (cut_length > 0) {
-                    auto *temp = r_node->next();
-                    if (!temp) {
-                        throw PieceTreeException(
-                            "The length of the cutout is greater than the length of the WHOLE text");
-                    }
-                    r_node = temp;
-                    r_piece_offset = 0;
-                } else {
-                    r_node->remove(root);
-                }
-            }
+// builds a perfectly balanced subtree over pieces[begin, end). A treap priority is drawn from the band picked by
+// the bit width of the subtree size, which shrinks from parent to child, so the priorities are heap ordered
+PieceTree::Node *PieceTree::build(std::vector<Piece> &pieces, std::size_t begin, std::size_t end, Node *parent,
+                                  std::uint32_t band) {
+    if (begin == end)
+        return nullptr;
+
+    std::size_t middle = begin + (end - begin) / 2;
+    Node *n = new Node(std::move(pieces[middle]));
+    n->parent = parent;
+    if constexpr (balance == Balance::Treap)
+        n->priority = static_cast<std::uint32_t>(std::bit_width(end - begin) - 1) * band + nextPriority() % band;
+    n->left = build(pieces, begin, middle, n, band);
+    n->right = build(pieces, middle + 1, end, n, band);
+    n->recalcMetadata();
+    return n;
+}
+
+// unlinks the children of node, which becomes a single-node tree
+PieceTree::Node *PieceTree::detach(Node *node) {
+    node->left = nullptr;
+    node->right = nullptr;
+    node->parent = nullptr;
+    node->recalcMetadata();
+    return node;
+}
+
+// concatenates left, middle, right; every key of left precedes middle, every key of right follows it.
+// O(|height(left) - height(right)|) with AVL, O(log n) expected with a treap
+PieceTree::Node *PieceTree::join(Node *left, Node *middle, Node *right) {
+    if constexpr (balance == Balance::Treap)
+        return merge(merge(left, middle), right);
+
+    int lh = left ? left->height : 0;
+    int rh = right ? right->height : 0;
+
+    if (lh > rh + 1) {
+        // descend the right spine of left until the subtree is no taller than right
+        Node *spine_parent = nullptr;
+        Node *spine = left;
+        while (spine && spine->height > rh + 1) {
+            spine_parent = spine;
+            spine = spine->right;
+        }
+
+        middle->left = spine;
+        middle->right = right;
+        middle->parent = spine_parent;
+        spine_parent->right = middle;
+        if (spine)
+            spine->parent = middle;
+        if (right)
+            right->parent = middle;
+        return middle->balanceAndUpdate();
+    }
+
+    if (rh > lh + 1) {
+        Node *spine_parent = nullptr;
+        Node *spine = right;
+        while (spine && spine->height > lh + 1) {
+            spine_parent = spine;
+            spine = spine->left;
         }
+
+        middle->right = spine;
+        middle->left = left;
+        middle->parent = spine_parent;
+        spine_parent->left = middle;
+        if (spine)
+            spine->parent = middle;
+        if (left)
+            left->parent = middle;
+        return middle->balanceAndUpdate();
+    }
+
+    middle->left = left;
+    middle->right = right;
+    middle->parent = nullptr;
+    if (left)
+        left->parent = middle;
+    if (right)
+        right->parent = middle;
+    middle->recalcMetadata();
+    return middle;
+}
+
+PieceTree::Node *PieceTree::join(Node *left, Node *right) {
+    if constexpr (balance == Balance::Treap)
+        return merge(left, right);
+
+    if (!left)
+        return right;
+    if (!right)
+        return left;
+
+    // the leftmost node of right becomes the middle
+    Node *middle = right->leftest();
+    Node *middle_parent = middle->parent;
+    if (middle_parent) {
+        middle_parent->left = middle->right;
+        if (middle->right)
+            middle->right->parent = middle_parent;
+        right = middle_parent->balanceAndUpdate();
+    } else {
+        right = middle->right;
+        if (right)
+            right->parent = nullptr;
+    }
+    detach(middle);
+
+    return join(left, middle, right);
+}
+
+// treap concatenation by priority, every piece of left precedes every piece of right. O(log n) expected
+PieceTree::Node *PieceTree::merge(Node *left, Node *right) {
+    if (!left || !right) {
+        Node *node = left ? left : right;
+        if (node)
+            node->parent = nullptr;
+        return node;
+    }
+
+    if (left->priority >= right->priority) {
+        left->right = merge(left->right, right);
+        left->right->parent = left;
+        left->parent = nullptr;
+        left->recalcMetadata();
+        return left;
+    }
+    right->left = merge(left, right->left);
+    right->left->parent = right;
+    right->parent = nullptr;
+    right->recalcMetadata();
+    return right;
+}
+
+// splits node's tree into the bytes before offset and the bytes from offset on,
+// a piece containing offset is cut in two
+std::pair<PieceTree::Node *, PieceTree::Node *> PieceTree::split(Node *node, Offset offset) const {
+    if (!node)
+        return {nullptr, nullptr};
+
+    Node *left = node->left;
+    Node *right = node->right;
+    if (left)
+        left->parent = nullptr;
+    if (right)
+        right->parent = nullptr;
+    detach(node);
+
+    Offset left_length = left ? left->subtree.length : 0;
+    if (offset <= left_length) {
+        auto [l, r] = split(left, offset);
+        return {l, join(r, node, right)};
+    }
+
+    offset -= left_length;
+    if (offset >= node->piece.length) {
+        auto [l, r] = split(right, offset - node->piece.length);
+        return {join(left, node, l), r};
+    }
+
+    if (!node->piece.indexed())
+        indexPiece(node);
+    Hash whole = node->own_hash;
+    Node *right_part = new Node(node->piece.splitAt(offset));
+    node->pieceChanged();
+    hashSplit(node, right_part, whole);
+    return {join(left, node, nullptr), join(nullptr, right_part, right)};
+}
+
+void PieceTree::destroy(Node *node) {
+    if (!node)
+        return;
+    destroy(node->left);
+    destroy(node->right);
+    delete node;
+}
+
+PieceTree::PieceTree() = default;
+
+PieceTree::PieceTree(PieceTree &&other) noexcept
+    : root(std::exchange(other.root, nullptr)), tail(std::exchange(other.tail, nullptr)),
+      text_source(std::move(other.text_source)),
+      marker_tree(std::move(other.marker_tree)), listeners(std::move(other.listeners)),
+      pending_changes(std::move(other.pending_changes)), batch_depth(std::exchange(other.batch_depth, 0)),
+      next_listener_id(other.next_listener_id) {}
+
+PieceTree &PieceTree::operator=(PieceTree &&other) noexcept {
+    if (this != &other) {
+        destroy(root);
+        root = std::exchange(other.root, nullptr);
+        tail = std::exchange(other.tail, nullptr);
+        text_source = std::move(other.text_source);
+        marker_tree = std::move(other.marker_tree);
+        listeners = std::move(other.listeners);
+        pending_changes = std::move(other.pending_changes);
+        batch_depth = std::exchange(other.batch_depth, 0);
+        next_listener_id = other.next_listener_id;
+    }
+    return *this;
+}
+
+PieceTree::~PieceTree() { destroy(root); }
+
+PieceTree PieceTree::clone() const {
+    PieceTree cloned;
+    if (root) {
+        NodeBlock *block = NodeBlock::allocate(root->subtree.pieces);
+        Node *slot = block->nodes();
+        cloned.root = copy(root, nullptr, slot, block);
     }
+    cloned.text_source = text_source;
+    return cloned;
+}
+
+PieceTree PieceTree::fromPieces(std::vector<Piece> pieces) {
+    PieceTree tree;
+    auto levels = static_cast<std::uint32_t>(std::max<std::size_t>(std::bit_width(pieces.size()), 1));
+    tree.root = build(pieces, 0, pieces.size(), nullptr, UINT32_MAX / levels);
+    return tree;
 }
 
 // insertionLine and insertionColumn are 0-based
 // insertionColumn including goes to the right node
-void PieceTree::insert(const Piece &new_piece, int insertion_line, int insertion_column) {
-    Node *new_node = new Node(new_piece);
-
+void PieceTree::insert(const Piece &new_piece, Offset insertion_line, Offset insertion_column) {
+    tail = nullptr;
+    const Offset inserted_line_breaks = new_piece.metricsBefore(new_piece.length).line_breaks;
     if (root == nullptr) {
-        root = new_node;
+        root = new Node(new_piece);
+        hashPiece(root);
+        if (marker_tree)
+            marker_tree->onInsert(0, new_piece.length);
+        recordChange(0, 0, 0, new_piece.length, inserted_line_breaks, 0);
         return;
     }
 
@@ -531,29 +1159,358 @@ void PieceTree::insert(const Piece &new_piece, int insertion_line, int insertion
     }
     Position insert = *result;
     insert = findVisualColumn(insert.node, insert.piece_offset, insertion_column);
+    Offset insertion_offset =
+        marker_tree || !listeners.empty() ? insert.node->prefixMetrics().length + insert.piece_offset : 0;
+
+    Node *new_node = new Node(new_piece);
+    hashPiece(new_node);
 
+    // only the path from the inserted node to the root is recalculated and rebalanced
     insertNodeAtPosition(insert, new_node);
 
-    // only the path from the inserted node to the root need recalculating and rebalancing
-    root = new_node->balanceAndUpdate();
+    if (marker_tree)
+        marker_tree->onInsert(insertion_offset, new_piece.length);
+    recordChange(insertion_offset, 0, 0, new_piece.length, inserted_line_breaks, insertion_line);
+}
+
+void PieceTree::append(const Piece &new_piece) {
+    if (!root) {
+        insert(new_piece, 0, 0);
+        tail = root;
+        return;
+    }
+
+    Metrics before = root->subtree;
+    if (!tail)
+        tail = root->rightest();
+    const Piece &last = tail->piece;
+    if (last.type == new_piece.type && last.offset + last.length == new_piece.offset && last.indexed() &&
+        new_piece.indexed() && last.length + new_piece.length <= append_merge_limit) {
+        extendPiece(tail, new_piece);
+    } else {
+        Node *new_node = new Node(new_piece);
+        hashPiece(new_node);
+        insertAfter(tail, new_node);
+        tail = new_node;
+    }
+
+    if (marker_tree)
+        marker_tree->onInsert(before.length, new_piece.length);
+    recordChange(before.length, 0, 0, new_piece.length, new_piece.metricsBefore(new_piece.length).line_breaks,
+                 before.line_breaks);
+}
+
+// grows the piece of node by more, which follows it in the same buffer. The aggregates of the piece are extended
+// by those of more instead of being recomputed, so the cost does not depend on the size of the piece
+void PieceTree::extendPiece(Node *node, const Piece &more) const {
+    Piece &piece = node->piece;
+    const Offset shift = piece.length;
+    // edit() only for tables that grow, it copies a table a snapshot still shares
+    if (!more.line_breaks.empty()) {
+        std::vector<Offset> &line_breaks = piece.line_breaks.edit();
+        for (Offset line_break : more.line_breaks)
+            line_breaks.push_back(line_break + shift);
+    }
+    if (!more.carriage_returns.empty()) {
+        std::vector<Offset> &carriage_returns = piece.carriage_returns.edit();
+        for (Offset carriage_return : more.carriage_returns)
+            carriage_returns.push_back(carriage_return + shift);
+    }
+    const std::size_t first_new_char = piece.multibyte_chars.size();
+    if (!more.multibyte_chars.empty()) {
+        std::vector<MultibyteChar> &multibyte_chars = piece.multibyte_chars.edit();
+        for (const MultibyteChar &ch : more.multibyte_chars)
+            multibyte_chars.push_back({ch.offset + shift, ch.width});
+    }
+    piece.countMultibyte(first_new_char);
+    piece.length += more.length;
+
+    node->own += more.metricsBefore(more.length);
+    node->own_extent += LineExtent::of(more);
+    node->own_endings += LineEndings::of(more);
+    if (text_source)
+        node->own_hash += Hash::of(text_source(more));
+    node->updateToRoot();
 }
 
 // line and column are 0-based
 // column is not automatically included, so the min length is 1;
-void PieceTree::remove(int line, int column, int length) {
+void PieceTree::remove(Offset line, Offset column, Offset length) {
+    // the cut out pieces are freed together with the returned tree
+    extract(line, column, length);
+}
+
+PieceTree PieceTree::extract(Offset line, Offset column, Offset length) {
+    tail = nullptr;
     if (length < 1)
         throw PieceTreeException("Cut length must be greater than 0");
-    std::optional<Position> result = findVisualLine(line, root);
-    if (!result) {
-        throw PieceTreeException("Removing: line " + std::to_string(line) + " not found in piece table");
+    Offset start = documentOffset(line, column);
+    if (start + length > root->subtree.length) {
+        throw PieceTreeException("The length of the cutout is greater than the length of the WHOLE text");
+    }
+
+    auto [before, rest] = split(root, start);
+    auto [range, after] = split(rest, length);
+    root = join(before, after);
+
+    if (marker_tree)
+        marker_tree->onRemove(start, length);
+    recordChange(start, length, range->subtree.line_breaks, 0, 0, line);
+
+    PieceTree extracted;
+    extracted.root = range;
+    extracted.text_source = text_source;
+    return extracted;
+}
+
+// other's pieces are moved in, starting at the position, other is left empty
+void PieceTree::insertTree(Offset line, Offset column, PieceTree &&other) {
+    tail = nullptr;
+    if (!other.root)
+        return;
+    Offset inserted_length = other.root->subtree.length;
+    Offset inserted_line_breaks = other.root->subtree.line_breaks;
+    Offset offset = root ? documentOffset(line, column) : 0;
+    Offset first_line = root ? line : 0;
+
+    auto [before, after] = split(root, offset);
+    root = join(join(before, std::exchange(other.root, nullptr)), after);
+
+    if (marker_tree)
+        marker_tree->onInsert(offset, inserted_length);
+    recordChange(offset, 0, 0, inserted_length, inserted_line_breaks, first_line);
+}
+
+void PieceTree::recordChange(Offset offset, Offset removed_length, Offset removed_line_breaks,
+                             Offset inserted_length, Offset inserted_line_breaks, Offset first_line) {
+    if (listeners.empty())
+        return;
+
+    Offset last_line_before = first_line + removed_line_breaks;
+    Offset last_line_after = first_line + inserted_line_breaks;
+    pending_changes.push_back({offset, removed_length, inserted_length, first_line, last_line_before,
+                               last_line_after, last_line_after - last_line_before});
+    if (batch_depth == 0)
+        endBatch();
+}
+
+PieceTree::ListenerId PieceTree::subscribe(ChangeListener listener) {
+    listeners.emplace_back(next_listener_id, std::move(listener));
+    return next_listener_id++;
+}
+
+void PieceTree::unsubscribe(ListenerId id) {
+    std::erase_if(listeners, [id](const auto &entry) { return entry.first == id; });
+}
+
+void PieceTree::beginBatch() { batch_depth++; }
+
+void PieceTree::endBatch() {
+    if (batch_depth > 0)
+        batch_depth--;
+    if (batch_depth > 0 || pending_changes.empty())
+        return;
+
+    for (auto &[id, listener] : listeners) {
+        listener(pending_changes);
     }
-    Position start_pos = *result;
-    start_pos = findVisualColumn(start_pos.node, start_pos.piece_offset, column);
+    pending_changes.clear();
+}
+
+// line is 0-based, the offset of the line past the last one is the document length
+PieceTree::Offset PieceTree::lineStartOffset(Offset line) const {
+    if (line == metrics().line_breaks + 1)
+        return metrics().length;
+    return root ? documentOffset(line, 0) : 0;
+}
 
-    removeStartingFromPosition(start_pos, length);
+PieceTree::Offset PieceTree::lineAt(Offset offset) const {
+    if (!root)
+        return 0;
+    Metrics before;
+    Position pos = findByUnit(offset, PositionUnit::Byte, before);
+    return before.line_breaks + pos.node->piece.metricsBefore(pos.piece_offset).line_breaks;
 }
 
-std::vector<const PieceTree::Piece *> PieceTree::getLinePieces(int line) {
+PieceTree::Offset PieceTree::maxLineLength() const {
+    if (!root)
+        return 0;
+    const LineExtent &extent = root->subtree_extent;
+    return std::max({extent.first, extent.last, extent.longest});
+}
+
+void PieceTree::checkNode(const Node *node, const Node *parent) const {
+    if (!node)
+        return;
+    auto fail = [&](const std::string &what) {
+        throw PieceTreeException("invariant broken at piece " + std::to_string(node->piece.offset) + "+" +
+                                 std::to_string(node->piece.length) + ": " + what);
+    };
+
+    if (node->parent != parent)
+        fail("parent link");
+    checkNode(node->left, node);
+    checkNode(node->right, node);
+
+    int lh = node->left ? node->left->height : 0;
+    int rh = node->right ? node->right->height : 0;
+    if (node->height != 1 + std::max(lh, rh))
+        fail("height");
+    if constexpr (balance == Balance::Avl) {
+        if (lh - rh < -1 || lh - rh > 1)
+            fail("balance");
+    } else {
+        if ((node->left && node->left->priority > node->priority) ||
+            (node->right && node->right->priority > node->priority))
+            fail("priority order");
+    }
+    if (node->left_line_count != (node->left ? node->left->subtree.line_breaks : 0))
+        fail("left_line_count");
+
+    Node fresh(node->piece);
+    if (node->own != fresh.own)
+        fail("piece metrics");
+    if (node->own_extent != fresh.own_extent)
+        fail("piece line extent");
+    if (node->own_endings != fresh.own_endings)
+        fail("piece line endings");
+    if (text_source && node->piece.indexed() && node->own_hash != Hash::of(text_source(node->piece)))
+        fail("piece hash");
+    Piece recounted = node->piece;
+    recounted.countMultibyte();
+    for (std::size_t i = 0; i < recounted.multibyte_chars.size(); i++) {
+        const MultibyteChar &kept = node->piece.multibyte_chars[i];
+        const MultibyteChar &expected = recounted.multibyte_chars[i];
+        if (kept.extra_bytes_before != expected.extra_bytes_before ||
+            kept.surrogate_pairs_before != expected.surrogate_pairs_before)
+            fail("multibyte running counts");
+    }
+
+    Metrics subtree = node->own;
+    LineExtent extent = node->left ? node->left->subtree_extent : LineExtent{};
+    extent += node->own_extent;
+    LineEndings endings = node->left ? node->left->subtree_endings : LineEndings{};
+    endings += node->own_endings;
+    Hash hash = node->left ? node->left->subtree_hash : Hash{};
+    hash += node->own_hash;
+    if (node->left)
+        subtree += node->left->subtree;
+    if (node->right) {
+        subtree += node->right->subtree;
+        extent += node->right->subtree_extent;
+        endings += node->right->subtree_endings;
+        hash += node->right->subtree_hash;
+    }
+    if (node->subtree != subtree)
+        fail("subtree metrics");
+    if (node->subtree_extent != extent)
+        fail("subtree line extent");
+    if (node->subtree_endings != endings)
+        fail("subtree line endings");
+    if (node->subtree_hash != hash)
+        fail("subtree hash");
+}
+
+void PieceTree::checkInvariants() const { checkNode(root, nullptr); }
+
+// sorted, merged [start, end) ranges of the buffer of type referenced by pieces below node
+std::vector<std::pair<PieceTree::Offset, PieceTree::Offset>> PieceTree::liveRanges(const Node *node, NodeType type) {
+    std::vector<std::pair<Offset, Offset>> ranges;
+    std::vector<const Node *> stack;
+    if (node)
+        stack.push_back(node);
+    while (!stack.empty()) {
+        const Node *n = stack.back();
+        stack.pop_back();
+        if (n->piece.type == type && n->piece.length > 0)
+            ranges.emplace_back(n->piece.offset, n->piece.offset + n->piece.length);
+        if (n->left)
+            stack.push_back(n->left);
+        if (n->right)
+            stack.push_back(n->right);
+    }
+
+    std::sort(ranges.begin(), ranges.end());
+    std::vector<std::pair<Offset, Offset>> merged;
+    for (const auto &range : ranges) {
+        if (!merged.empty() && range.first <= merged.back().second)
+            merged.back().second = std::max(merged.back().second, range.second);
+        else
+            merged.push_back(range);
+    }
+    return merged;
+}
+
+PieceTree::MemoryUsage PieceTree::memoryUsage(std::optional<Offset> added_buffer_size) const {
+    MemoryUsage usage;
+    for (const Node *node = root ? root->leftest() : nullptr; node; node = const_cast<Node *>(node)->next()) {
+        const Piece &piece = node->piece;
+        usage.pieces++;
+        usage.node_bytes += sizeof(Node);
+        // a table another piece refers to as well, e.g. in a clone or a SharedBuffer index, is not this tree's alone
+        auto count = [&usage](const auto &table, std::size_t &bytes) {
+            std::size_t item = sizeof(*table.data());
+            if (table.shared()) {
+                usage.shared_bytes += table.capacity() * item;
+                return;
+            }
+            bytes += table.capacity() * item;
+            usage.spare_bytes += (table.capacity() - table.size()) * item;
+        };
+        count(piece.line_breaks, usage.line_break_bytes);
+        count(piece.carriage_returns, usage.line_break_bytes);
+        count(piece.multibyte_chars, usage.multibyte_bytes);
+    }
+
+    for (const auto &[start, end] : liveRanges(root, NodeType::Original))
+        usage.live_original_bytes += end - start;
+    auto added = liveRanges(root, NodeType::Added);
+    for (const auto &[start, end] : added)
+        usage.live_added_bytes += end - start;
+    Offset added_size = added_buffer_size.value_or(added.empty() ? 0 : added.back().second);
+    usage.dead_added_bytes = added_size - usage.live_added_bytes;
+    return usage;
+}
+
+void PieceTree::shrinkToFit() {
+    for (Node *node = root ? root->leftest() : nullptr; node; node = node->next()) {
+        node->piece.line_breaks.shrinkToFit();
+        node->piece.multibyte_chars.shrinkToFit();
+        node->piece.carriage_returns.shrinkToFit();
+    }
+    pending_changes.shrink_to_fit();
+    listeners.shrink_to_fit();
+}
+
+void PieceTree::compactAdded(std::string &added) {
+    auto live = liveRanges(root, NodeType::Added);
+
+    // live ranges are laid out back to back, new_starts[i] is where live[i] goes
+    std::string compacted;
+    std::vector<Offset> new_starts;
+    for (const auto &[start, end] : live) {
+        new_starts.push_back(static_cast<Offset>(compacted.size()));
+        compacted.append(added, start, end - start);
+    }
+
+    for (Node *node = root ? root->leftest() : nullptr; node; node = node->next()) {
+        Piece &piece = node->piece;
+        if (piece.type != NodeType::Added || piece.length == 0)
+            continue;
+        auto range = std::upper_bound(live.begin(), live.end(), piece.offset,
+                                      [](Offset offset, const auto &r) { return offset < r.first; }) - 1;
+        piece.offset = new_starts[range - live.begin()] + (piece.offset - range->first);
+    }
+    added = std::move(compacted);
+}
+
+MarkerTree &PieceTree::markers() {
+    if (!marker_tree)
+        marker_tree = std::make_unique<MarkerTree>();
+    return *marker_tree;
+}
+
+std::vector<const PieceTree::Piece *> PieceTree::getLinePieces(Offset line) const {
     std::optional<Position> result = findVisualLine(line, root);
     if (!result) {
         throw PieceTreeException("Getting: line " + std::to_string(line) + " not found in piece table");
@@ -561,4 +1518,224 @@ std::vector<const PieceTree::Piece *> PieceTree::getLinePieces(int line) {
     Position line_pos = *result;
 
     return getLinePiecesFromPosition(line_pos);
-}
\ No newline at end of file
+}
+
+// descends by the subtree metrics of unit, before receives the metrics of everything left of the found piece
+PieceTree::Position PieceTree::findByUnit(Offset value, PositionUnit unit, Metrics &before) const {
+    if (!root || value < 0 || value > root->subtree.get(unit)) {
+        throw PieceTreeException("position " + std::to_string(value) + " is out of document bounds");
+    }
+
+    const Offset original_value = value;
+    Node *node = root;
+    while (true) {
+        Offset left_value = node->left ? node->left->subtree.get(unit) : 0;
+        if (value < left_value) {
+            node = node->left;
+            continue;
+        }
+        value -= left_value;
+        if (node->left)
+            before += node->left->subtree;
+
+        Offset own_value = node->own.get(unit);
+        if (value <= own_value || !node->right) {
+            // code points inside an unscanned piece are unknown
+            if (unit != PositionUnit::Byte && !node->piece.indexed()) {
+                indexPiece(node);
+                before = {};
+                return findByUnit(original_value, unit, before);
+            }
+            return {node, node->piece.byteOffsetOf(value, unit)};
+        }
+        value -= own_value;
+        before += node->own;
+        node = node->right;
+    }
+}
+
+PieceTree::Offset PieceTree::convertOffset(Offset offset, PositionUnit from, PositionUnit to) const {
+    if (!root && offset == 0)
+        return 0;
+
+    Metrics before;
+    Position pos = findByUnit(offset, from, before);
+    return before.get(to) + pos.node->piece.metricsBefore(pos.piece_offset).get(to);
+}
+
+// line is 0-based, column is counted in from units from the line beginning
+PieceTree::Offset PieceTree::convertColumn(Offset line, Offset column, PositionUnit from, PositionUnit to) const {
+    if (!root && line == 0)
+        return convertOffset(column, from, to);
+
+    std::optional<Position> result = findVisualLine(line, root);
+    if (!result) {
+        throw PieceTreeException("Converting: line " + std::to_string(line) + " not found in piece table");
+    }
+    Metrics line_start = result->node->prefixMetrics();
+    line_start += result->node->piece.metricsBefore(result->piece_offset);
+
+    return convertOffset(line_start.get(from) + column, from, to) - line_start.get(to);
+}
+
+// unindexed pieces are hashed once they are scanned, so attaching a source does not read them
+void PieceTree::hashPiece(Node *node) const {
+    if (text_source && node->piece.indexed()) {
+        node->own_hash = Hash::of(text_source(node->piece));
+        node->recalcMetadata();
+    }
+}
+
+// left and right are the halves of a piece that hashed to whole, only the shorter half is read
+void PieceTree::hashSplit(Node *left, Node *right, const Hash &whole) const {
+    if (!text_source || !left->piece.indexed() || !right->piece.indexed())
+        return;
+    if (left->piece.length <= right->piece.length) {
+        left->own_hash = Hash::of(text_source(left->piece));
+        right->own_hash = whole.withoutPrefix(left->own_hash);
+    } else {
+        right->own_hash = Hash::of(text_source(right->piece));
+        left->own_hash = whole.withoutSuffix(right->own_hash);
+    }
+    left->recalcMetadata();
+    right->recalcMetadata();
+}
+
+// scans an unindexed piece in place, only the metadata on the path to the root changes
+void PieceTree::indexPiece(Node *node) const {
+    if (!text_source)
+        throw PieceTreeException("Indexing: no text source attached");
+    node->piece = Piece::fromText(node->piece.type, node->piece.offset, text_source(node->piece));
+    node->pieceChanged();
+    hashPiece(node);
+    node->updateToRoot();
+}
+
+void PieceTree::collectUnindexed(const Node *node, std::vector<Piece> &pieces) {
+    if (!node || node->subtree.unindexed == 0)
+        return;
+    collectUnindexed(node->left, pieces);
+    if (!node->piece.indexed())
+        pieces.push_back(node->piece);
+    collectUnindexed(node->right, pieces);
+}
+
+std::vector<PieceTree::Piece> PieceTree::unindexedPieces() const {
+    std::vector<Piece> pieces;
+    collectUnindexed(root, pieces);
+    return pieces;
+}
+
+// scanned is sorted by buffer position, only subtrees holding unindexed pieces are visited
+std::size_t PieceTree::applyIndex(Node *node, std::vector<Piece> &scanned) const {
+    if (!node || node->subtree.unindexed == 0)
+        return 0;
+
+    std::size_t applied = applyIndex(node->left, scanned) + applyIndex(node->right, scanned);
+    if (!node->piece.indexed()) {
+        auto it = std::lower_bound(scanned.begin(), scanned.end(), node->piece, [](const Piece &a, const Piece &b) {
+            return std::pair(a.type, a.offset) < std::pair(b.type, b.offset);
+        });
+        if (it != scanned.end() && it->type == node->piece.type && it->offset == node->piece.offset &&
+            it->length == node->piece.length && it->indexed()) {
+            node->piece = *it; // copied, a chunk may be referenced by several pieces
+            node->pieceChanged();
+            hashPiece(node);
+            applied++;
+        }
+    }
+    node->recalcMetadata();
+    return applied;
+}
+
+std::size_t PieceTree::applyIndex(std::vector<Piece> scanned) {
+    std::sort(scanned.begin(), scanned.end(), [](const Piece &a, const Piece &b) {
+        return std::pair(a.type, a.offset) < std::pair(b.type, b.offset);
+    });
+    return applyIndex(root, scanned);
+}
+
+void PieceTree::indexAll(Node *node) {
+    if (!node || node->subtree.unindexed == 0)
+        return;
+    indexAll(node->left);
+    indexAll(node->right);
+    if (!node->piece.indexed()) {
+        node->piece = Piece::fromText(node->piece.type, node->piece.offset, text_source(node->piece));
+        node->pieceChanged();
+        hashPiece(node);
+    }
+    node->recalcMetadata();
+}
+
+void PieceTree::indexAll() {
+    if (fullyIndexed())
+        return;
+    if (!text_source)
+        throw PieceTreeException("Indexing: no text source attached");
+    indexAll(root);
+}
+
+void PieceTree::rehash(Node *node) const {
+    if (!node)
+        return;
+    rehash(node->left);
+    rehash(node->right);
+    hashPiece(node);
+}
+
+void PieceTree::setTextSource(TextSource source) {
+    text_source = std::move(source);
+    rehash(root);
+}
+
+std::uint64_t PieceTree::contentHash() const {
+    if (!text_source)
+        throw PieceTreeException("Hashing: no text source attached");
+    if (!fullyIndexed())
+        throw PieceTreeException("Hashing: tree is not fully indexed");
+    return root ? root->subtree_hash.value : 0;
+}
+
+// start and end are relative to node's subtree and may lie outside of it
+PieceTree::Hash PieceTree::hashRange(const Node *node, Offset start, Offset end) const {
+    if (!node || start >= end || end <= 0 || start >= node->subtree.length)
+        return {};
+    if (start <= 0 && end >= node->subtree.length)
+        return node->subtree_hash;
+
+    Offset left_length = node->left ? node->left->subtree.length : 0;
+    Offset own_length = node->own.length;
+
+    Hash h = hashRange(node->left, start, end);
+
+    Offset piece_start = std::clamp<Offset>(start - left_length, 0, own_length);
+    Offset piece_end = std::clamp<Offset>(end - left_length, 0, own_length);
+    if (piece_start == 0 && piece_end == own_length) {
+        h += node->own_hash;
+    } else if (piece_start < piece_end) {
+        // whichever is shorter is read, the covered part or the parts of the piece around it
+        std::string_view text = text_source(node->piece);
+        if (piece_end - piece_start <= own_length / 2) {
+            h += Hash::of(text.substr(piece_start, piece_end - piece_start));
+        } else {
+            h += node->own_hash.withoutPrefix(Hash::of(text.substr(0, piece_start)))
+                     .withoutSuffix(Hash::of(text.substr(piece_end)));
+        }
+    }
+
+    h += hashRange(node->right, start - left_length - own_length, end - left_length - own_length);
+    return h;
+}
+
+std::uint64_t PieceTree::rangeHash(Offset start, Offset end) const {
+    if (!text_source)
+        throw PieceTreeException("Hashing: no text source attached");
+    if (!fullyIndexed())
+        throw PieceTreeException("Hashing: tree is not fully indexed");
+    if (start < 0 || start > end || end > metrics().length) {
+        throw PieceTreeException("Hashing: range [" + std::to_string(start) + ", " + std::to_string(end) +
+                                 ") is out of document bounds");
+    }
+    return hashRange(root, start, end).value;
+}
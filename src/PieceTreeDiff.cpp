@@ -0,0 +1,285 @@
+#include "../include/PieceTree.h"
+
+#include <algorithm>
+#include <map>
+
+namespace {
+using Offset = PieceTree::Offset;
+
+// the part of a piece inside a diff region, at is its document offset
+struct Segment {
+    NodeType type;
+    Offset buffer;
+    Offset length;
+    Offset at;
+};
+
+// text of before at a and of after at b shared for length bytes
+struct Run {
+    Offset a;
+    Offset b;
+    Offset length;
+};
+
+// the longest total of runs that keeps its order in both versions, runs are in the order of after and do not
+// overlap there. Chains are extended from a frontier of best totals by end offset in before, O(r log r)
+std::vector<Run> longestChain(const std::vector<Run> &runs) {
+    std::map<Offset, std::pair<Offset, int>> frontier; // end in before -> total and last run, both increasing
+    std::vector<int> previous(runs.size(), -1);
+    for (int i = 0; i < static_cast<int>(runs.size()); i++) {
+        const Run &run = runs[i];
+        auto it = frontier.upper_bound(run.a);
+        auto [total, last] = it == frontier.begin() ? std::pair<Offset, int>(0, -1) : std::prev(it)->second;
+        previous[i] = last;
+        total += run.length;
+
+        Offset end = run.a + run.length;
+        it = frontier.upper_bound(end);
+        if (it != frontier.begin() && std::prev(it)->second.first >= total)
+            continue;
+        frontier[end] = {total, i};
+        it = frontier.upper_bound(end);
+        while (it != frontier.end() && it->second.first <= total)
+            it = frontier.erase(it);
+    }
+
+    std::vector<Run> chain;
+    for (int i = frontier.empty() ? -1 : frontier.rbegin()->second.second; i >= 0; i = previous[i])
+        chain.push_back(runs[i]);
+    std::reverse(chain.begin(), chain.end());
+    return chain;
+}
+
+// lines of before holding [a_start, a_end) replaced by the lines of after holding [b_start, b_end)
+PieceTree::DiffHunk lineHunk(const PieceTree &before, const PieceTree &after, Offset a_start, Offset a_end,
+                             Offset b_start, Offset b_end) {
+    Offset old_first_line = before.lineAt(a_start);
+    Offset new_first_line = after.lineAt(b_start);
+    Offset old_last_line = before.lineAt(a_end);
+    Offset new_last_line = after.lineAt(b_end);
+
+    // when both changed regions end at a line start, that line begins the shared text behind them and is untouched
+    bool ends_at_line_start =
+        before.lineStartOffset(old_last_line) == a_end && after.lineStartOffset(new_last_line) == b_end;
+    Offset extra_line = ends_at_line_start ? 0 : 1;
+    return {old_first_line, old_last_line - old_first_line + extra_line, new_first_line,
+            new_last_line - new_first_line + extra_line};
+}
+} // namespace
+
+// byte offset as a node and an offset inside its piece, an offset on a piece boundary may resolve to either
+// of the two pieces
+PieceTree::Position PieceTree::positionAt(Offset offset) const {
+    Metrics before;
+    return findByUnit(offset, PositionUnit::Byte, before);
+}
+
+bool PieceTree::isPieceBoundary(Offset offset) const {
+    if (offset == 0 || offset == metrics().length)
+        return true;
+    Position pos = positionAt(offset);
+    return pos.piece_offset == 0 || pos.piece_offset == pos.node->piece.length;
+}
+
+PieceTree::Offset PieceTree::commonPrefix(const PieceTree &a, const PieceTree &b) {
+    Offset prefix = 0;
+    const Offset limit = std::min(a.metrics().length, b.metrics().length);
+
+    // skip whole subtrees of a whose end is a piece boundary in b as well and whose text hashes equal,
+    // aligned boundaries keep both hashes free of partial pieces
+    if (a.text_source && b.text_source && a.fullyIndexed() && b.fullyIndexed()) {
+        auto equalUpTo = [&](Offset end) {
+            return end <= limit && b.isPieceBoundary(end) && a.rangeHash(0, end) == b.rangeHash(0, end);
+        };
+
+        Offset base = 0;
+        for (const Node *node = a.root; node;) {
+            Offset left_end = base + (node->left ? node->left->subtree.length : 0);
+            Offset piece_end = left_end + node->own.length;
+            if (equalUpTo(piece_end)) {
+                prefix = piece_end;
+                base = piece_end;
+                node = node->right;
+            } else if (left_end > prefix && equalUpTo(left_end)) {
+                prefix = left_end;
+                break;
+            } else {
+                node = node->left;
+            }
+        }
+    }
+
+    if (prefix == limit)
+        return prefix;
+
+    // pieces reading the same buffer bytes are equal without looking at the text
+    Position pa = a.positionAt(prefix);
+    Position pb = b.positionAt(prefix);
+    while (pa.node && pb.node && prefix < limit) {
+        if (pa.piece_offset == pa.node->piece.length) {
+            pa = {pa.node->next(), 0};
+            continue;
+        }
+        if (pb.piece_offset == pb.node->piece.length) {
+            pb = {pb.node->next(), 0};
+            continue;
+        }
+        const Piece &x = pa.node->piece;
+        const Piece &y = pb.node->piece;
+        if (x.type != y.type || x.offset + pa.piece_offset != y.offset + pb.piece_offset)
+            break;
+
+        Offset step = std::min(x.length - pa.piece_offset, y.length - pb.piece_offset);
+        prefix += step;
+        pa.piece_offset += step;
+        pb.piece_offset += step;
+    }
+    return std::min(prefix, limit);
+}
+
+// suffix shared by a and b, at most limit bytes long
+PieceTree::Offset PieceTree::commonSuffix(const PieceTree &a, const PieceTree &b, Offset limit) {
+    const Offset a_length = a.metrics().length;
+    const Offset b_length = b.metrics().length;
+    Offset suffix = 0;
+
+    if (a.text_source && b.text_source && a.fullyIndexed() && b.fullyIndexed()) {
+        auto equalFrom = [&](Offset length) {
+            return length <= limit && b.isPieceBoundary(b_length - length) &&
+                   a.rangeHash(a_length - length, a_length) == b.rangeHash(b_length - length, b_length);
+        };
+
+        Offset base = 0; // bytes right of the current subtree
+        for (const Node *node = a.root; node;) {
+            Offset right_start = base + (node->right ? node->right->subtree.length : 0);
+            Offset piece_start = right_start + node->own.length;
+            if (equalFrom(piece_start)) {
+                suffix = piece_start;
+                base = piece_start;
+                node = node->left;
+            } else if (right_start > suffix && equalFrom(right_start)) {
+                suffix = right_start;
+                break;
+            } else {
+                node = node->right;
+            }
+        }
+    }
+
+    if (suffix == limit)
+        return suffix;
+
+    // offsets inside the pieces where the matched suffix begins
+    Position pa = a.positionAt(a_length - suffix);
+    Position pb = b.positionAt(b_length - suffix);
+    while (pa.node && pb.node && suffix < limit) {
+        if (pa.piece_offset == 0) {
+            Node *prev = pa.node->prev();
+            pa = {prev, prev ? prev->piece.length : 0};
+            continue;
+        }
+        if (pb.piece_offset == 0) {
+            Node *prev = pb.node->prev();
+            pb = {prev, prev ? prev->piece.length : 0};
+            continue;
+        }
+        const Piece &x = pa.node->piece;
+        const Piece &y = pb.node->piece;
+        if (x.type != y.type || x.offset + pa.piece_offset != y.offset + pb.piece_offset)
+            break;
+
+        Offset step = std::min(pa.piece_offset, pb.piece_offset);
+        suffix += step;
+        pa.piece_offset -= step;
+        pb.piece_offset -= step;
+    }
+    return std::min(suffix, limit);
+}
+
+std::vector<PieceTree::DiffHunk> PieceTree::diff(const PieceTree &before, const PieceTree &after) {
+    const Offset old_length = before.metrics().length;
+    const Offset new_length = after.metrics().length;
+
+    Offset prefix = commonPrefix(before, after);
+    if (prefix == old_length && prefix == new_length)
+        return {};
+    Offset suffix = commonSuffix(before, after, std::min(old_length, new_length) - prefix);
+    Offset old_end = old_length - suffix;
+    Offset new_end = new_length - suffix;
+
+    // the pieces between prefix and suffix
+    auto segmentsOf = [](const PieceTree &tree, Offset start, Offset end) {
+        std::vector<Segment> segments;
+        if (start >= end)
+            return segments;
+        Position pos = tree.positionAt(start);
+        Offset at = start - pos.piece_offset;
+        for (Node *node = pos.node; node && at < end; at += node->piece.length, node = node->next()) {
+            Offset from = std::max(at, start);
+            Offset to = std::min(at + node->piece.length, end);
+            if (from >= to)
+                continue;
+            segments.push_back({node->piece.type, node->piece.offset + from - at, to - from, from});
+        }
+        return segments;
+    };
+    std::vector<Segment> old_segments = segmentsOf(before, prefix, old_end);
+    std::vector<Segment> new_segments = segmentsOf(after, prefix, new_end);
+
+    // text shared inside the changed region, i.e. pieces of both versions reading the same buffer bytes
+    auto byBuffer = [](const Segment &x, const Segment &y) {
+        return std::pair(x.type, x.buffer) < std::pair(y.type, y.buffer);
+    };
+    std::sort(old_segments.begin(), old_segments.end(), byBuffer);
+
+    std::vector<Run> runs;
+    for (const Segment &segment : new_segments) {
+        std::size_t found = runs.size();
+        auto it = std::upper_bound(old_segments.begin(), old_segments.end(), segment, byBuffer);
+        if (it != old_segments.begin())
+            --it;
+        Segment end{segment.type, segment.buffer + segment.length, 0, 0};
+        for (; it != old_segments.end() && byBuffer(*it, end); ++it) {
+            Offset from = std::max(it->buffer, segment.buffer);
+            Offset to = std::min(it->buffer + it->length, segment.buffer + segment.length);
+            if (it->type == segment.type && from < to)
+                runs.push_back({it->at + from - it->buffer, segment.at + from - segment.buffer, to - from});
+        }
+        std::sort(runs.begin() + static_cast<std::ptrdiff_t>(found), runs.end(),
+                  [](const Run &x, const Run &y) { return x.b < y.b; });
+    }
+
+    // every gap between the shared runs is a changed region unless its text hashes equal, e.g. after retyping,
+    // and regions meeting on a line become one hunk
+    bool hashed = before.text_source && after.text_source && before.fullyIndexed() && after.fullyIndexed();
+    std::vector<DiffHunk> hunks;
+    auto addRegion = [&](Offset a_start, Offset a_end, Offset b_start, Offset b_end) {
+        if (a_end - a_start == b_end - b_start &&
+            (a_start == a_end || (hashed && before.rangeHash(a_start, a_end) == after.rangeHash(b_start, b_end))))
+            return;
+        DiffHunk hunk = lineHunk(before, after, a_start, a_end, b_start, b_end);
+        if (!hunks.empty()) {
+            DiffHunk &last = hunks.back();
+            Offset old_last_end = last.old_first_line + last.old_line_count;
+            Offset new_last_end = last.new_first_line + last.new_line_count;
+            if (hunk.old_first_line <= old_last_end || hunk.new_first_line <= new_last_end) {
+                last.old_line_count =
+                    std::max(old_last_end, hunk.old_first_line + hunk.old_line_count) - last.old_first_line;
+                last.new_line_count =
+                    std::max(new_last_end, hunk.new_first_line + hunk.new_line_count) - last.new_first_line;
+                return;
+            }
+        }
+        hunks.push_back(hunk);
+    };
+
+    Offset a = prefix;
+    Offset b = prefix;
+    for (const Run &run : longestChain(runs)) {
+        addRegion(a, run.a, b, run.b);
+        a = run.a + run.length;
+        b = run.b + run.length;
+    }
+    addRegion(a, old_end, b, new_end);
+    return hunks;
+}
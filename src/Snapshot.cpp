@@ -0,0 +1,313 @@
+#include "../include/Snapshot.h"
+
+#include <bit>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <limits>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static_assert(std::endian::native == std::endian::little, "snapshots are stored little-endian");
+
+namespace Snapshot {
+namespace {
+constexpr char magic[8] = {'P', 'T', 'S', 'N', 'A', 'P', '\r', '\n'};
+constexpr std::uint64_t version = 2;
+constexpr std::size_t header_size = 32; // magic, version, payload size, checksum
+constexpr std::uint64_t unindexed_flag = 0x100;
+
+// layout of the payload, every field is a 64-bit word:
+//   path length, path bytes (padded to 8), original size, mtime, hash
+//   added length, added bytes (padded to 8)
+//   piece count, per piece: type, offset, length, line break count, carriage return count, multibyte char
+//   count; an unindexed piece has unindexed_flag set in its type and its estimate as line break count, its
+//   arrays are empty
+//   all line break offsets, all carriage return offsets, then all multibyte chars as (offset, width) pairs
+
+std::uint64_t checksum(const char *data, std::size_t size) {
+    std::uint64_t h = 0x243f6a8885a308d3ULL ^ size;
+    std::size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        std::uint64_t word;
+        std::memcpy(&word, data + i, 8);
+        h = (h ^ word) * 0x9e3779b97f4a7c15ULL;
+        h ^= h >> 29;
+    }
+    for (; i < size; i++)
+        h = (h ^ static_cast<unsigned char>(data[i])) * 0x100000001b3ULL;
+    return h ^ (h >> 32);
+}
+
+std::int64_t mtimeOf(const struct stat &st) {
+    return static_cast<std::int64_t>(st.st_mtim.tv_sec) * 1'000'000'000 + st.st_mtim.tv_nsec;
+}
+
+PieceTreeException ioError(const std::string &what, const std::string &path) {
+    return PieceTreeException(what + " " + path + ": " + std::strerror(errno));
+}
+
+class Encoder {
+  public:
+    std::string data;
+
+    void word(std::uint64_t value) { data.append(reinterpret_cast<const char *>(&value), 8); }
+
+    void bytes(std::string_view text) {
+        word(text.size());
+        data.append(text);
+        data.append((8 - text.size() % 8) % 8, '\0');
+    }
+};
+
+// bounds checked reads from the mapped payload
+class Decoder {
+  public:
+    Decoder(const char *data, std::size_t size, std::uint64_t at) : data(data), size(size), at(at) {
+        if (at > size)
+            throw PieceTreeException("truncated snapshot");
+    }
+
+    std::uint64_t word() {
+        need(8);
+        std::uint64_t value;
+        std::memcpy(&value, data + at, 8);
+        at += 8;
+        return value;
+    }
+
+    std::string_view bytes() {
+        std::uint64_t length = word();
+        need(length);
+        std::string_view text(data + at, length);
+        at += (length + 7) / 8 * 8;
+        return text;
+    }
+
+    void need(std::uint64_t bytes) const {
+        if (at > size || bytes > size - at)
+            throw PieceTreeException("truncated snapshot");
+    }
+
+    std::uint64_t position() const { return at; }
+
+  private:
+    const char *data;
+    std::size_t size;
+    std::uint64_t at; // may pass size after the padding of a cut off string, need catches it
+};
+} // namespace
+
+OriginalFile OriginalFile::describe(const std::string &path, std::string_view contents) {
+    struct stat st {};
+    if (::stat(path.c_str(), &st) != 0)
+        throw ioError("cannot stat", path);
+    return {path, static_cast<std::uint64_t>(st.st_size), mtimeOf(st), PieceTree::Hash::of(contents).value};
+}
+
+bool OriginalFile::isCurrent() const {
+    struct stat st {};
+    return ::stat(path.c_str(), &st) == 0 && static_cast<std::uint64_t>(st.st_size) == size && mtimeOf(st) == mtime;
+}
+
+void save(const std::string &path, PieceTree &tree, std::string_view added, const OriginalFile &original) {
+    Encoder out;
+    out.data.append(header_size, '\0');
+    out.bytes(original.path);
+    out.word(original.size);
+    out.word(original.mtime);
+    out.word(original.hash);
+    out.bytes(added);
+
+    std::uint64_t piece_count = 0;
+    for ([[maybe_unused]] auto &piece : tree)
+        piece_count++;
+    out.word(piece_count);
+    for (auto &piece : tree) {
+        out.word(static_cast<std::uint64_t>(piece.type) | (piece.indexed() ? 0 : unindexed_flag));
+        out.word(piece.offset);
+        out.word(piece.length);
+        out.word(piece.indexed() ? piece.line_breaks.size() : *piece.estimated_line_breaks);
+        out.word(piece.carriage_returns.size());
+        out.word(piece.multibyte_chars.size());
+    }
+    for (auto &piece : tree)
+        for (PieceTree::Offset line_break : piece.line_breaks)
+            out.word(line_break);
+    for (auto &piece : tree)
+        for (PieceTree::Offset carriage_return : piece.carriage_returns)
+            out.word(carriage_return);
+    for (auto &piece : tree)
+        for (const auto &mb : piece.multibyte_chars) {
+            out.word(mb.offset);
+            out.word(mb.width);
+        }
+
+    std::uint64_t payload_size = out.data.size() - header_size;
+    std::uint64_t sum = checksum(out.data.data() + header_size, payload_size);
+    std::memcpy(out.data.data(), magic, 8);
+    std::memcpy(out.data.data() + 8, &version, 8);
+    std::memcpy(out.data.data() + 16, &payload_size, 8);
+    std::memcpy(out.data.data() + 24, &sum, 8);
+
+    std::string temporary = path + ".tmp";
+    int fd = ::open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        throw ioError("cannot create", temporary);
+    // on every failure the temporary file is closed and removed, the error keeps errno of the failing call
+    auto failure = [&](const char *what, const std::string &name) {
+        PieceTreeException error = ioError(what, name);
+        if (fd >= 0)
+            ::close(fd);
+        ::unlink(temporary.c_str());
+        return error;
+    };
+
+    std::string_view rest = out.data;
+    while (!rest.empty()) {
+        ssize_t written = ::write(fd, rest.data(), rest.size());
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written < 0)
+            throw failure("cannot write", temporary);
+        rest.remove_prefix(written);
+    }
+    if (::fsync(fd) != 0)
+        throw failure("cannot sync", temporary);
+    int closed = ::close(fd);
+    fd = -1;
+    if (closed != 0)
+        throw failure("cannot close", temporary);
+    if (std::rename(temporary.c_str(), path.c_str()) != 0)
+        throw failure("cannot replace", path);
+}
+
+Mapped::Mapped(const std::string &path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw ioError("cannot open", path);
+    struct stat st {};
+    if (::fstat(fd, &st) != 0) {
+        ::close(fd);
+        throw ioError("cannot stat", path);
+    }
+    mapping_size = static_cast<std::size_t>(st.st_size);
+    if (mapping_size < header_size) {
+        ::close(fd);
+        throw PieceTreeException("not a snapshot: " + path);
+    }
+    mapping = ::mmap(nullptr, mapping_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        mapping = nullptr;
+        throw ioError("cannot map", path);
+    }
+
+    try {
+        const char *data = static_cast<const char *>(mapping);
+        std::uint64_t file_version, payload_size, sum;
+        std::memcpy(&file_version, data + 8, 8);
+        std::memcpy(&payload_size, data + 16, 8);
+        std::memcpy(&sum, data + 24, 8);
+        if (std::memcmp(data, magic, 8) != 0)
+            throw PieceTreeException("not a snapshot: " + path);
+        if (file_version != version)
+            throw PieceTreeException("unsupported snapshot version " + std::to_string(file_version));
+        if (payload_size != mapping_size - header_size || checksum(data + header_size, payload_size) != sum)
+            throw PieceTreeException("corrupt snapshot: " + path);
+
+        Decoder in(data, mapping_size, header_size);
+        original_file.path = std::string(in.bytes());
+        original_file.size = in.word();
+        original_file.mtime = static_cast<std::int64_t>(in.word());
+        original_file.hash = in.word();
+        added_buffer = in.bytes();
+        pieces_at = in.position();
+    } catch (...) {
+        ::munmap(mapping, mapping_size);
+        throw;
+    }
+}
+
+Mapped::~Mapped() {
+    if (mapping)
+        ::munmap(mapping, mapping_size);
+}
+
+PieceTree Mapped::buildTree() const {
+    const char *data = static_cast<const char *>(mapping);
+    Decoder in(data, mapping_size, pieces_at);
+    // counts are checked against the mapping before anything is allocated for them
+    const std::uint64_t max_words = mapping_size / 8;
+    std::uint64_t piece_count = in.word();
+    if (piece_count > max_words / 6)
+        throw PieceTreeException("corrupt snapshot piece table");
+
+    // the arrays follow the piece table, their readers advance alongside it
+    std::vector<PieceTree::Piece> pieces(piece_count);
+    std::uint64_t total_line_breaks = 0, total_carriage_returns = 0, total_multibyte = 0;
+    for (auto &piece : pieces) {
+        std::uint64_t type = in.word();
+        bool unindexed = type & unindexed_flag;
+        type &= ~unindexed_flag;
+        if (type > static_cast<std::uint64_t>(NodeType::Added))
+            throw PieceTreeException("corrupt snapshot piece");
+        piece.type = static_cast<NodeType>(type);
+        // a piece has to lie inside its buffer, the text is read through it without further checks
+        std::uint64_t buffer_size = piece.type == NodeType::Original ? original_file.size : added_buffer.size();
+        std::uint64_t offset = in.word();
+        std::uint64_t length = in.word();
+        if (offset > buffer_size || length > buffer_size - offset ||
+            buffer_size > static_cast<std::uint64_t>(std::numeric_limits<PieceTree::Offset>::max()))
+            throw PieceTreeException("corrupt snapshot piece");
+        piece.offset = static_cast<PieceTree::Offset>(offset);
+        piece.length = static_cast<PieceTree::Offset>(length);
+        std::uint64_t line_break_count = in.word();
+        std::uint64_t carriage_return_count = in.word();
+        std::uint64_t multibyte_count = in.word();
+        if (unindexed) {
+            piece.estimated_line_breaks = static_cast<PieceTree::Offset>(line_break_count);
+            line_break_count = 0;
+        }
+        // running totals, so that no sequence of pieces allocates more than the mapping can hold
+        if (line_break_count > max_words - total_line_breaks ||
+            carriage_return_count > max_words - total_carriage_returns ||
+            multibyte_count > (max_words - 2 * total_multibyte) / 2)
+            throw PieceTreeException("corrupt snapshot piece");
+        piece.line_breaks = std::vector<PieceTree::Offset>(line_break_count);
+        piece.carriage_returns = std::vector<PieceTree::Offset>(carriage_return_count);
+        piece.multibyte_chars = std::vector<PieceTree::MultibyteChar>(multibyte_count);
+        total_line_breaks += line_break_count;
+        total_carriage_returns += carriage_return_count;
+        total_multibyte += multibyte_count;
+    }
+
+    Decoder line_breaks(data, mapping_size, in.position());
+    Decoder carriage_returns(data, mapping_size, in.position() + total_line_breaks * 8);
+    Decoder multibyte(data, mapping_size, in.position() + (total_line_breaks + total_carriage_returns) * 8);
+    // empty tables are left without storage, edit() would give them some
+    for (auto &piece : pieces) {
+        if (!piece.line_breaks.empty()) {
+            for (auto &line_break : piece.line_breaks.edit())
+                line_break = static_cast<PieceTree::Offset>(line_breaks.word());
+        }
+        if (!piece.carriage_returns.empty()) {
+            for (auto &carriage_return : piece.carriage_returns.edit())
+                carriage_return = static_cast<PieceTree::Offset>(carriage_returns.word());
+        }
+        if (!piece.multibyte_chars.empty()) {
+            for (auto &mb : piece.multibyte_chars.edit()) {
+                mb.offset = static_cast<PieceTree::Offset>(multibyte.word());
+                std::uint64_t width = multibyte.word();
+                if (width < 2 || width > 4)
+                    throw PieceTreeException("corrupt snapshot multibyte character");
+                mb.width = static_cast<std::uint8_t>(width);
+            }
+        }
+        piece.countMultibyte(); // the running counts are not stored
+    }
+    return PieceTree::fromPieces(std::move(pieces));
+}
+} // namespace Snapshot
@@ -0,0 +1,120 @@
+#include "../include/BufferStore.h"
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+TEST(Append, ContiguousPiecesExtendTheLastOne) {
+    Buffers b;
+    b.original = "one\r\ntwo ✓\r\nthree\nfour";
+    PieceTree tree;
+    tree.setTextSource(b.source());
+
+    // one cut falls inside a CR LF
+    for (auto [start, end] : {std::pair{0, 4}, {4, 9}, {9, 20}, {20, 24}})
+        tree.append(PieceTree::Piece::fromText(NodeType::Original, start, b.original.substr(start, end - start)));
+
+    ASSERT_EQ(tree.metrics().pieces, 1);
+    ASSERT_EQ(tree.metrics().line_breaks, 3);
+    ASSERT_EQ(tree.metrics().code_points, 22);
+    ASSERT_EQ(tree.lineEndings().crlf, 2);
+    ASSERT_EQ(tree.maxLineLength(), 7); // "two ✓" without the CR of its CR LF
+    ASSERT_EQ(tree.contentHash(), PieceTree::Hash::of(b.original).value);
+    ASSERT_EQ(tree.lineStartOffset(3), 20);
+    ASSERT_NO_THROW(tree.checkInvariants());
+
+    // another buffer or a gap in the buffer starts a new piece
+    b.added = "xy";
+    tree.append(PieceTree::Piece::fromText(NodeType::Added, 0, "x"));
+    tree.append(PieceTree::Piece::fromText(NodeType::Added, 1, "y"));
+    ASSERT_EQ(tree.metrics().pieces, 2);
+    b.original += "--tail";
+    tree.append(PieceTree::Piece::fromText(NodeType::Original, 26, "tail"));
+    ASSERT_EQ(tree.metrics().pieces, 3);
+    ASSERT_NO_THROW(tree.checkInvariants());
+}
+
+TEST(Append, CrLfSplitBetweenPiecesIsNotPartOfTheLine) {
+    Buffers b;
+    PieceTree tree;
+    tree.setTextSource(b.source());
+
+    // the Added offsets leave a gap, so the pieces stay apart and the CR LF spans two of them
+    tree.append(b.add("abcdef\r"));
+    b.added += "-";
+    tree.append(b.add("\nxy\r"));
+    ASSERT_EQ(tree.metrics().pieces, 2);
+    ASSERT_EQ(tree.maxLineLength(), 6);
+
+    // a lone CR is part of its line
+    tree.append(b.add("0123456"));
+    b.added += "-";
+    tree.append(b.add("\n"));
+    ASSERT_EQ(tree.maxLineLength(), 10); // "xy\r0123456"
+    ASSERT_NO_THROW(tree.checkInvariants());
+
+    tree.remove(1, 2, 1);
+    ASSERT_EQ(tree.maxLineLength(), 9);
+    tree.remove(0, 0, 7); // "abcdef\r", the LF now starts the document
+    tree.append(b.add(std::string(9, 'z') + "\r"));
+    b.added += "-";
+    tree.append(b.add("\n"));
+    ASSERT_EQ(tree.maxLineLength(), 9);
+    ASSERT_NO_THROW(tree.checkInvariants());
+}
+
+TEST(Append, MixedWithEdits) {
+    std::mt19937 rng(23);
+    Buffers b;
+    std::string text;
+    PieceTree tree;
+    tree.setTextSource(b.source());
+
+    for (int i = 0; i < 2000; i++) {
+        if (rng() % 4 != 0 || text.empty()) {
+            // mostly appends continuing the buffer, so the last piece keeps growing
+            std::string piece = Util::randomText(rng, 1 + rng() % 8);
+            tree.append(b.add(piece));
+            text += piece;
+        } else {
+            Util::randomEdit(rng, tree, text, b.added, 10, 8);
+        }
+
+        ASSERT_EQ(tree.metrics().length, static_cast<PieceTree::Offset>(text.size()));
+        ASSERT_EQ(tree.contentHash(), PieceTree::Hash::of(text).value) << "step " << i;
+    }
+    ASSERT_NO_THROW(tree.checkInvariants());
+}
+
+TEST(Append, ChangeEvents) {
+    PieceTree tree;
+    std::vector<PieceTree::Change> seen;
+    tree.subscribe([&](std::span<const PieceTree::Change> changes) { seen.assign(changes.begin(), changes.end()); });
+
+    tree.append(PieceTree::Piece::fromText(NodeType::Added, 0, "a\nb"));
+    tree.append(PieceTree::Piece::fromText(NodeType::Added, 3, "c\nd\n"));
+    ASSERT_EQ(seen.size(), 1);
+    ASSERT_EQ(seen[0].offset, 3);
+    ASSERT_EQ(seen[0].inserted_length, 4);
+    ASSERT_EQ(seen[0].first_line, 1);
+    ASSERT_EQ(seen[0].line_delta, 2);
+}
+
+TEST(Append, FullBlockIsNotMergedWithTheNext) {
+    BufferStore store;
+    AddedBuffer added(store);
+    PieceTree tree;
+    tree.setTextSource([&](const PieceTree::Piece &piece) { return added.text(piece); });
+
+    std::string full(BufferStore::block_size, 'a');
+    tree.append(added.append(full));
+    tree.append(added.append("bc"));
+    ASSERT_EQ(tree.metrics().pieces, 2);
+
+    std::string text;
+    for (auto &piece : tree)
+        text += added.text(piece);
+    ASSERT_EQ(text, full + "bc");
+    ASSERT_EQ(tree.contentHash(), PieceTree::Hash::of(full + "bc").value);
+}
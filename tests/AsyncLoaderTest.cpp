@@ -0,0 +1,119 @@
+#include "../include/AsyncLoader.h"
+#include "Util.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+void writeFile(const std::string &path, const std::string &contents) {
+    std::ofstream(path, std::ios::binary) << contents;
+}
+
+std::string sampleText(int lines) {
+    std::string text;
+    for (int i = 0; i < lines; i++)
+        text += "line " + std::to_string(i) + " – ✓\n";
+    return text;
+}
+
+void runUntilDone(OwnerExecutor &owner, const LoadTask &task) {
+    while (!task.done())
+        owner.runPending(std::chrono::milliseconds(10));
+}
+
+std::string textOf(PieceTree &tree, const OriginalBuffer &original, const std::string &added) {
+    std::string text;
+    for (auto &piece : tree)
+        text += piece.type == NodeType::Original ? std::string(original.text(piece))
+                                                 : added.substr(piece.offset, piece.length);
+    return text;
+}
+} // namespace
+
+TEST(AsyncLoader, LoadsInChunks) {
+    std::string contents = sampleText(2000);
+    TempFile file("async_chunks.txt");
+    const std::string &path = file.path;
+    writeFile(path, contents);
+
+    ThreadPool pool(2);
+    OwnerExecutor owner;
+    PieceTree tree;
+    OriginalBuffer original;
+    std::vector<LoadProgress> reports;
+
+    LoadTask task = openAsync(path, tree, original, pool, owner, {},
+                              [&](const LoadProgress &p) { reports.push_back(p); }, 1000);
+    runUntilDone(owner, task);
+
+    LoadProgress result = task.result();
+    ASSERT_FALSE(result.cancelled);
+    ASSERT_EQ(result.loaded, contents.size());
+    ASSERT_GT(reports.size(), contents.size() / 1000);
+    ASSERT_EQ(reports.back().loaded, reports.back().total);
+    ASSERT_EQ(textOf(tree, original, ""), contents);
+    ASSERT_EQ(tree.metrics().line_breaks, 2000);
+    PieceTree::Piece whole = PieceTree::Piece::fromText(NodeType::Original, 0, contents);
+    ASSERT_EQ(tree.metrics().code_points, whole.metricsBefore(whole.length).code_points);
+    for (auto &piece : tree)
+        ASSERT_TRUE(PieceTree::isValidUtf8(original.text(piece)));
+}
+
+TEST(AsyncLoader, EditWhileLoading) {
+    std::string contents = sampleText(5000);
+    TempFile file("async_edit.txt");
+    const std::string &path = file.path;
+    writeFile(path, contents);
+
+    ThreadPool pool(1);
+    OwnerExecutor owner;
+    PieceTree tree;
+    OriginalBuffer original;
+    std::string added = "typed early\n";
+    bool edited = false;
+
+    LoadTask task = openAsync(path, tree, original, pool, owner, {}, {}, 4096);
+    while (!task.done()) {
+        owner.runPending(std::chrono::milliseconds(10));
+        if (!edited && tree.metrics().length > 0) {
+            tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, added), 0, 0);
+            edited = true;
+        }
+    }
+    ASSERT_TRUE(edited);
+    ASSERT_EQ(textOf(tree, original, added), added + contents);
+}
+
+TEST(AsyncLoader, Cancellation) {
+    std::string contents = sampleText(5000);
+    TempFile file("async_cancel.txt");
+    const std::string &path = file.path;
+    writeFile(path, contents);
+
+    ThreadPool pool(1);
+    OwnerExecutor owner;
+    PieceTree tree;
+    OriginalBuffer original;
+    std::stop_source stop;
+
+    LoadTask task = openAsync(path, tree, original, pool, owner, stop.get_token(),
+                              [&](const LoadProgress &) { stop.request_stop(); }, 1024);
+    runUntilDone(owner, task);
+
+    LoadProgress result = task.result();
+    ASSERT_TRUE(result.cancelled);
+    ASSERT_LT(result.loaded, result.total);
+    ASSERT_EQ(tree.metrics().length, result.loaded);
+    ASSERT_EQ(textOf(tree, original, ""), contents.substr(0, result.loaded));
+}
+
+TEST(AsyncLoader, MissingFile) {
+    ThreadPool pool(1);
+    OwnerExecutor owner;
+    PieceTree tree;
+    OriginalBuffer original;
+
+    LoadTask task = openAsync("/nonexistent/piecetree/file", tree, original, pool, owner, {});
+    runUntilDone(owner, task);
+    ASSERT_THROW((void)task.result(), PieceTreeException);
+}
@@ -0,0 +1,62 @@
+#include "../include/BufferStore.h"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(BufferStore, IdenticalContentIsShared) {
+    BufferStore store;
+    std::string contents = "vendored\nfile\n";
+
+    auto first = store.intern(contents);
+    auto second = store.intern(contents);
+    auto other = store.intern("something else");
+    ASSERT_EQ(first.get(), second.get());
+    ASSERT_NE(first.get(), other.get());
+    ASSERT_EQ(store.size(), 2);
+
+    other.reset();
+    ASSERT_EQ(store.size(), 1);
+    first.reset();
+    ASSERT_EQ(store.size(), 1); // second still holds it
+    second.reset();
+    ASSERT_EQ(store.size(), 0);
+}
+
+TEST(BufferStore, TreesFromSharedIndex) {
+    BufferStore store;
+    auto buffer = store.intern("one\ntwö\nthree");
+    ASSERT_EQ(buffer->index().line_breaks.size(), 2);
+
+    PieceTree a = buffer->makeTree();
+    PieceTree b = buffer->makeTree();
+    a.remove(0, 0, 4);
+    ASSERT_EQ(a.metrics().line_breaks, 1);
+    ASSERT_EQ(b.metrics().line_breaks, 2);
+    ASSERT_EQ(b.metrics().code_points, 13);
+
+    b.setTextSource([&](const PieceTree::Piece &p) { return buffer->text().substr(p.offset, p.length); });
+    ASSERT_EQ(b.contentHash(), buffer->hash());
+}
+
+TEST(BufferStore, AddedBlocksAreRecycled) {
+    BufferStore store;
+    std::string big(BufferStore::block_size + 10, 'b');
+    {
+        AddedBuffer added(store);
+        PieceTree::Piece hello = added.append("hello\n");
+        PieceTree::Piece filler = added.append(std::string(BufferStore::block_size - 3, 'x'));
+        PieceTree::Piece oversized = added.append(big);
+        PieceTree::Piece tail = added.append("tail");
+
+        ASSERT_EQ(added.text(hello), "hello\n");
+        ASSERT_EQ(added.text(filler).size(), BufferStore::block_size - 3);
+        ASSERT_EQ(added.text(oversized), big);
+        ASSERT_EQ(added.text(tail), "tail");
+        ASSERT_EQ(hello.line_breaks.size(), 1);
+        ASSERT_EQ(store.freeBlocks(), 0);
+    }
+    ASSERT_EQ(store.freeBlocks(), 3);
+
+    AddedBuffer next(store);
+    next.append("reuses a block");
+    ASSERT_EQ(store.freeBlocks(), 2);
+}
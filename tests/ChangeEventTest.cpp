@@ -0,0 +1,82 @@
+#include "../include/PieceTree.h"
+#include <gtest/gtest.h>
+#include <vector>
+
+TEST(PieceTreeChanges, InsertAndRemoveRecords) {
+    PieceTree tree;
+    std::vector<PieceTree::Change> seen;
+    tree.subscribe([&](std::span<const PieceTree::Change> changes) {
+        ASSERT_EQ(changes.size(), 1);
+        seen.push_back(changes[0]);
+    });
+
+    tree.insert({NodeType::Added, 0, 8, {3}}, 0, 0);  // "abc\ndefg"
+    tree.insert({NodeType::Added, 8, 3, {1}}, 1, 2);  // "abc\nde" "x\ny" "fg"
+    tree.remove(0, 1, 5);                             // "a" "e" "x\ny" "fg"
+
+    ASSERT_EQ(seen.size(), 3);
+
+    ASSERT_EQ(seen[0].offset, 0);
+    ASSERT_EQ(seen[0].inserted_length, 8);
+    ASSERT_EQ(seen[0].line_delta, 1);
+
+    ASSERT_EQ(seen[1].offset, 6);
+    ASSERT_EQ(seen[1].first_line, 1);
+    ASSERT_EQ(seen[1].last_line_before, 1);
+    ASSERT_EQ(seen[1].last_line_after, 2);
+    ASSERT_EQ(seen[1].line_delta, 1);
+
+    ASSERT_EQ(seen[2].offset, 1);
+    ASSERT_EQ(seen[2].removed_length, 5);
+    ASSERT_EQ(seen[2].first_line, 0);
+    ASSERT_EQ(seen[2].last_line_before, 1);
+    ASSERT_EQ(seen[2].last_line_after, 0);
+    ASSERT_EQ(seen[2].line_delta, -1);
+}
+
+TEST(PieceTreeChanges, Batching) {
+    PieceTree tree;
+    tree.insert({NodeType::Added, 0, 4, {3}}, 0, 0); // "abc\n"
+
+    int deliveries = 0;
+    std::size_t delivered = 0;
+    PieceTree::ListenerId id = tree.subscribe([&](std::span<const PieceTree::Change> changes) {
+        deliveries++;
+        delivered += changes.size();
+    });
+
+    tree.beginBatch();
+    tree.insert({NodeType::Added, 4, 1, {}}, 0, 0);
+    tree.beginBatch();
+    tree.insert({NodeType::Added, 5, 1, {}}, 0, 0);
+    tree.endBatch();
+    ASSERT_EQ(deliveries, 0);
+    tree.remove(0, 0, 1);
+    tree.endBatch();
+
+    ASSERT_EQ(deliveries, 1);
+    ASSERT_EQ(delivered, 3);
+
+    tree.unsubscribe(id);
+    tree.insert({NodeType::Added, 6, 1, {}}, 0, 0);
+    ASSERT_EQ(deliveries, 1);
+}
+
+TEST(PieceTreeChanges, PasteReportsLines) {
+    PieceTree tree;
+    tree.insert({NodeType::Added, 0, 8, {3, 7}}, 0, 0); // "abc\ndef\n"
+
+    std::vector<PieceTree::Change> seen;
+    tree.subscribe([&](std::span<const PieceTree::Change> changes) {
+        seen.insert(seen.end(), changes.begin(), changes.end());
+    });
+
+    PieceTree line = tree.extract(0, 0, 4);
+    tree.insertTree(1, 0, std::move(line));
+
+    ASSERT_EQ(seen.size(), 2);
+    ASSERT_EQ(seen[0].line_delta, -1);
+    ASSERT_EQ(seen[1].offset, 4);
+    ASSERT_EQ(seen[1].first_line, 1);
+    ASSERT_EQ(seen[1].last_line_after, 2);
+}
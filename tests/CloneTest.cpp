@@ -0,0 +1,60 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <memory>
+#include <random>
+#include <string>
+
+TEST(Clone, IndependentOfOriginal) {
+    std::mt19937 rng(3);
+    std::string added, text;
+    PieceTree tree;
+    for (int i = 0; i < 300; i++)
+        Util::randomEdit(rng, tree, text, added);
+
+    PieceTree cloned = tree.clone();
+    ASSERT_EQ(Util::textOf(cloned, "", added), text);
+    ASSERT_EQ(cloned.metrics().pieces, tree.metrics().pieces);
+    ASSERT_EQ(cloned.maxLineLength(), tree.maxLineLength());
+
+    std::string cloned_text = text;
+    for (int i = 0; i < 300; i++) {
+        Util::randomEdit(rng, tree, text, added);
+        Util::randomEdit(rng, cloned, cloned_text, added);
+    }
+    ASSERT_EQ(Util::textOf(tree, "", added), text);
+    ASSERT_EQ(Util::textOf(cloned, "", added), cloned_text);
+}
+
+TEST(Clone, OutlivesOriginal) {
+    std::mt19937 rng(8);
+    std::string added, text;
+    auto tree = std::make_unique<PieceTree>();
+    for (int i = 0; i < 200; i++)
+        Util::randomEdit(rng, *tree, text, added);
+
+    // a clone of a clone, then the trees its nodes came from go away
+    PieceTree first = tree->clone();
+    PieceTree second = first.clone();
+    tree.reset();
+    first = PieceTree();
+
+    // cut and paste moves nodes of the block between trees, each is freed on its own
+    PieceTree cut = second.extract(0, 0, text.size() / 2);
+    PieceTree::Offset end = second.metrics().length;
+    second.insertTree(second.lineAt(end), end - second.lineStartOffset(second.lineAt(end)), std::move(cut));
+    text = text.substr(text.size() / 2) + text.substr(0, text.size() / 2);
+    ASSERT_EQ(Util::textOf(second, "", added), text);
+
+    for (int i = 0; i < 300; i++)
+        Util::randomEdit(rng, second, text, added);
+    ASSERT_EQ(Util::textOf(second, "", added), text);
+}
+
+TEST(Clone, Empty) {
+    PieceTree tree;
+    PieceTree cloned = tree.clone();
+    ASSERT_EQ(cloned.metrics().length, 0);
+    cloned.insert(PieceTree::Piece::fromText(NodeType::Added, 0, "x"), 0, 0);
+    ASSERT_EQ(cloned.metrics().length, 1);
+}
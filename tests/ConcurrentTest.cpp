@@ -0,0 +1,149 @@
+#include "../include/ConcurrentPieceTree.h"
+#include <atomic>
+#include <string>
+#include <gtest/gtest.h>
+#include <thread>
+#include <vector>
+
+TEST(PieceTreeConcurrent, SnapshotKeepsVersionAlive) {
+    ConcurrentPieceTree doc;
+    ConcurrentPieceTree::Reader reader = doc.reader();
+
+    doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 0, 4, {3}}, 0, 0); }); // "abc\n"
+
+    {
+        ConcurrentPieceTree::Snapshot snapshot = reader.pin();
+        doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 4, 2, {}}, 1, 0); });
+
+        // the pinned version is unchanged and not freed
+        ASSERT_EQ(snapshot->metrics().length, 4);
+        ASSERT_EQ(doc.pendingReclamation(), 1);
+    }
+
+    ASSERT_EQ(doc.pendingReclamation(), 0);
+    ASSERT_EQ(reader.pin()->metrics().length, 6);
+}
+
+TEST(PieceTreeConcurrent, NestedSnapshotsOfOneReader) {
+    ConcurrentPieceTree doc;
+    ConcurrentPieceTree::Reader reader = doc.reader();
+    doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 0, 4, {3}}, 0, 0); });
+
+    ConcurrentPieceTree::Snapshot outer = reader.pin();
+    doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 4, 2, {}}, 1, 0); });
+    {
+        ConcurrentPieceTree::Snapshot inner = reader.pin();
+        ASSERT_EQ(inner->metrics().length, 6);
+    }
+
+    // releasing the inner snapshot leaves the outer one pinned
+    doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 6, 1, {}}, 1, 0); });
+    ASSERT_EQ(doc.pendingReclamation(), 2);
+    ASSERT_EQ(outer->metrics().length, 4);
+}
+
+TEST(PieceTreeConcurrent, ReadersDuringEdits) {
+    ConcurrentPieceTree doc;
+    std::atomic<bool> done = false;
+    std::atomic<int> inconsistent = 0;
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < 4; r++) {
+        readers.emplace_back([&] {
+            ConcurrentPieceTree::Reader reader = doc.reader();
+            PieceTree::Offset last_length = 0;
+            while (!done.load()) {
+                ConcurrentPieceTree::Snapshot snapshot = reader.pin();
+                PieceTree::Metrics m = snapshot->metrics();
+                // every edit inserts "x\n", a version never shows half of one
+                if (m.length != 2 * m.line_breaks || m.length < last_length)
+                    inconsistent++;
+                if (m.line_breaks > 0 && snapshot->getLinePieces(m.line_breaks - 1).empty())
+                    inconsistent++;
+                last_length = m.length;
+            }
+        });
+    }
+
+    for (int i = 0; i < 500; i++) {
+        doc.edit([i](PieceTree &tree) { tree.insert({NodeType::Added, 2 * i, 2, {1}}, i / 2, 0); });
+    }
+    done = true;
+    for (std::thread &t : readers) {
+        t.join();
+    }
+
+    ASSERT_EQ(inconsistent, 0);
+    ASSERT_EQ(doc.pendingReclamation(), 0);
+    ASSERT_EQ(doc.reader().pin()->metrics().length, 1000);
+}
+
+TEST(PieceTreeConcurrent, StagedEditsArePublishedOnce) {
+    ConcurrentPieceTree doc;
+    ConcurrentPieceTree::Reader reader = doc.reader();
+    ConcurrentPieceTree::Reader holder = doc.reader();
+
+    ConcurrentPieceTree::Snapshot before = holder.pin();
+    for (int i = 0; i < 100; i++)
+        doc.stage([i](PieceTree &tree) { tree.insert({NodeType::Added, i, 1, {}}, 0, i); });
+    ASSERT_EQ(reader.pin()->metrics().length, 0);
+    ASSERT_EQ(doc.pendingReclamation(), 0);
+
+    doc.publish();
+    doc.publish(); // nothing staged, no new version
+    ASSERT_EQ(reader.pin()->metrics().length, 100);
+    ASSERT_EQ(doc.pendingReclamation(), 1); // only the version pinned by before
+}
+
+TEST(PieceTreeConcurrent, ReadersDoNotWaitForTheWriter) {
+    ConcurrentPieceTree doc;
+    doc.edit([](PieceTree &tree) { tree.insert({NodeType::Added, 0, 2, {1}}, 0, 0); });
+
+    // the writer stays inside its change until every reader got through a batch of reads
+    constexpr int reader_count = 8;
+    std::atomic<int> finished = 0;
+    std::thread writer([&] {
+        doc.edit([&](PieceTree &tree) {
+            while (finished.load() < reader_count)
+                std::this_thread::yield();
+            tree.insert({NodeType::Added, 2, 2, {1}}, 1, 0);
+        });
+    });
+
+    std::vector<std::thread> readers;
+    for (int r = 0; r < reader_count; r++) {
+        readers.emplace_back([&] {
+            ConcurrentPieceTree::Reader reader = doc.reader();
+            for (int i = 0; i < 1000; i++)
+                ASSERT_EQ(reader.pin()->metrics().length, 2);
+            finished++;
+        });
+    }
+    for (std::thread &t : readers)
+        t.join();
+    writer.join();
+
+    ASSERT_EQ(doc.reader().pin()->metrics().length, 4);
+}
+
+TEST(PieceTreeConcurrent, PublishedVersionsAreFullyIndexed) {
+    std::string text = "ab\ncd\nef";
+    PieceTree initial;
+    initial.setTextSource([&](const PieceTree::Piece &p) { return std::string_view(text).substr(p.offset, p.length); });
+    initial.append(PieceTree::Piece::unindexed(NodeType::Original, 0, 3, 0));
+
+    // readers would otherwise scan the pieces from their lookups, writing to the shared version
+    ConcurrentPieceTree doc(std::move(initial));
+    ConcurrentPieceTree::Reader reader = doc.reader();
+    ASSERT_TRUE(reader.pin()->fullyIndexed());
+    ASSERT_EQ(reader.pin()->metrics().line_breaks, 1);
+
+    doc.edit([](PieceTree &tree) { tree.append(PieceTree::Piece::unindexed(NodeType::Original, 3, 6, 0)); });
+    ASSERT_TRUE(reader.pin()->fullyIndexed());
+    ASSERT_EQ(reader.pin()->metrics().line_breaks, 2);
+
+    ConcurrentPieceTree sourceless;
+    auto unindexed = [](PieceTree &tree) { tree.append(PieceTree::Piece::unindexed(NodeType::Original, 0, 4, 1)); };
+    ASSERT_THROW(sourceless.edit(unindexed), PieceTreeException);
+    ASSERT_EQ(sourceless.reader().pin()->metrics().length, 0);
+}
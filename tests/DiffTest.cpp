@@ -0,0 +1,109 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+void expectHunks(const std::vector<PieceTree::DiffHunk> &hunks, const std::vector<PieceTree::DiffHunk> &expected) {
+    ASSERT_EQ(hunks.size(), expected.size());
+    for (std::size_t i = 0; i < hunks.size(); i++) {
+        EXPECT_EQ(hunks[i].old_first_line, expected[i].old_first_line) << "hunk " << i;
+        EXPECT_EQ(hunks[i].old_line_count, expected[i].old_line_count) << "hunk " << i;
+        EXPECT_EQ(hunks[i].new_first_line, expected[i].new_first_line) << "hunk " << i;
+        EXPECT_EQ(hunks[i].new_line_count, expected[i].new_line_count) << "hunk " << i;
+    }
+}
+
+void expectHunk(const std::vector<PieceTree::DiffHunk> &hunks, PieceTree::Offset old_first,
+                PieceTree::Offset old_count, PieceTree::Offset new_first, PieceTree::Offset new_count) {
+    expectHunks(hunks, {{old_first, old_count, new_first, new_count}});
+}
+} // namespace
+
+TEST(PieceTreeDiff, IdenticalVersions) {
+    Buffers b{"one\ntwo\nthree\n", ""};
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, b.original), 0, 0);
+
+    PieceTree copy = tree.clone();
+    ASSERT_TRUE(PieceTree::diff(tree, copy).empty());
+    ASSERT_TRUE(PieceTree::diff(PieceTree(), PieceTree()).empty());
+}
+
+TEST(PieceTreeDiff, EditInsideLine) {
+    Buffers b{"one\ntwo\nthree\n", ""};
+    PieceTree before;
+    before.insert(PieceTree::Piece::fromText(NodeType::Original, 0, b.original), 0, 0);
+
+    // the saved version is a single piece, the pieces of the edited one are slices of it
+    PieceTree after = before.clone();
+    after.insert(b.add("XY"), 1, 1);
+    expectHunk(PieceTree::diff(before, after), 1, 1, 1, 1);
+
+    after.remove(2, 0, 2);
+    expectHunk(PieceTree::diff(before, after), 1, 2, 1, 2);
+    expectHunk(PieceTree::diff(after, before), 1, 2, 1, 2);
+}
+
+TEST(PieceTreeDiff, WholeLines) {
+    Buffers b{"one\ntwo\nthree\n", ""};
+    PieceTree before;
+    before.insert(PieceTree::Piece::fromText(NodeType::Original, 0, b.original), 0, 0);
+
+    PieceTree inserted = before.clone();
+    inserted.insert(b.add("new\nlines\n"), 1, 0);
+    expectHunk(PieceTree::diff(before, inserted), 1, 0, 1, 2);
+
+    PieceTree removed = before.clone();
+    removed.remove(0, 0, 4);
+    expectHunk(PieceTree::diff(before, removed), 0, 1, 0, 0);
+}
+
+TEST(PieceTreeDiff, ManyPiecesWithAndWithoutHashes) {
+    Buffers b{"", ""};
+    PieceTree before;
+    for (int i = 0; i < 500; i++)
+        before.insert(b.add("line " + std::to_string(i) + "\n"), i, 0);
+
+    PieceTree after = before.clone();
+    after.insert(b.add("edit"), 250, 2);
+    after.insert(b.add("more\n"), 260, 0);
+
+    expectHunks(PieceTree::diff(before, after), {{250, 1, 250, 1}, {260, 0, 260, 1}});
+
+    before.setTextSource(b.source());
+    after.setTextSource(b.source());
+    expectHunks(PieceTree::diff(before, after), {{250, 1, 250, 1}, {260, 0, 260, 1}});
+
+    // equal text in differently split pieces is skipped by hash
+    PieceTree retyped = before.clone();
+    retyped.remove(100, 0, 9);
+    retyped.insert(b.add("line 100\n"), 100, 0);
+    ASSERT_TRUE(PieceTree::diff(before, retyped).empty());
+}
+
+TEST(PieceTreeDiff, SeparateChangesGiveSeparateHunks) {
+    Buffers b{"", ""};
+    for (int i = 0; i < 100; i++)
+        b.original += "line " + std::to_string(i) + "\n";
+    PieceTree before;
+    before.insert(PieceTree::Piece::fromText(NodeType::Original, 0, b.original), 0, 0);
+
+    PieceTree after = before.clone();
+    after.insert(b.add("X"), 10, 2);
+    after.remove(80, 0, 8);
+    after.insert(b.add("new\n"), 80, 0);
+    expectHunks(PieceTree::diff(before, after), {{10, 1, 10, 1}, {80, 1, 80, 1}});
+
+    // changes on neighbouring lines form one hunk
+    after.insert(b.add("Y"), 11, 0);
+    expectHunks(PieceTree::diff(before, after), {{10, 2, 10, 2}, {80, 1, 80, 1}});
+
+    // text retyped as it was is skipped by its hash
+    before.setTextSource(b.source());
+    after.setTextSource(b.source());
+    after.remove(50, 0, 8);
+    after.insert(b.add("line 50\n"), 50, 0);
+    after.insert(b.add("Z"), 40, 0);
+    expectHunks(PieceTree::diff(before, after), {{10, 2, 10, 2}, {40, 1, 40, 1}, {80, 1, 80, 1}});
+}
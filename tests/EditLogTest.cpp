@@ -0,0 +1,155 @@
+#include "../include/EditLog.h"
+#include "Util.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+size_t pieceCount(PieceTree &tree) {
+    size_t count = 0;
+    for ([[maybe_unused]] auto &piece : tree)
+        count++;
+    return count;
+}
+} // namespace
+
+TEST(EditLog, WriteAndReplay) {
+    TempFile log("replay.log");
+    const std::string &path = log.path;
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 0, "hello\nworld");
+        writer.logInsert(0, 0, ">> ");
+        writer.logRemove(1, 0, 2);
+        writer.logInsert(1, 3, "é\n!");
+    }
+
+    std::string data = EditLog::Reader::readFile(path);
+    PieceTree tree;
+    std::string added;
+    ASSERT_EQ(EditLog::replay(data, tree, added), 4);
+    ASSERT_EQ(Util::textOf(tree, "", added), ">> hello\nrldé\n!");
+    ASSERT_EQ(tree.metrics().line_breaks, 2);
+}
+
+TEST(EditLog, TypingIsMergedIntoOnePiece) {
+    std::string original = "ab\ncd";
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, original), 0, 0);
+
+    TempFile log("typing.log");
+    const std::string &path = log.path;
+    {
+        EditLog::Writer writer(path);
+        std::string typed = "xy\nzw";
+        for (size_t i = 0, line = 0, column = 1; i < typed.size(); i++) {
+            writer.logInsert(line, column, typed.substr(i, 1));
+            if (typed[i] == '\n')
+                line++, column = 0;
+            else
+                column++;
+        }
+        writer.logRemove(1, 1, 1); // backspace
+        writer.logRemove(1, 0, 1);
+        writer.logInsert(1, 0, "q");
+    }
+
+    std::string added;
+    ASSERT_EQ(EditLog::replay(EditLog::Reader::readFile(path), tree, added), 8);
+    ASSERT_EQ(Util::textOf(tree, original, added), "axy\nqb\ncd");
+    ASSERT_EQ(added, "xy\nq");
+    ASSERT_EQ(pieceCount(tree), 3);
+}
+
+TEST(EditLog, BackspaceOverLineBreakKeepsMerging) {
+    std::string original = "12";
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, original), 0, 0);
+
+    TempFile log("backspace_break.log");
+    const std::string &path = log.path;
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 1, "ab\n");
+        writer.logInsert(1, 0, "c\nd");
+        writer.logRemove(1, 1, 2); // "\nd"
+        writer.logRemove(0, 3, 2); // "\nc"
+        writer.logInsert(0, 3, "e");
+    }
+
+    std::string added;
+    ASSERT_EQ(EditLog::replay(EditLog::Reader::readFile(path), tree, added), 5);
+    ASSERT_EQ(Util::textOf(tree, original, added), "1abe2");
+    ASSERT_EQ(added, "abe");
+    ASSERT_EQ(pieceCount(tree), 3);
+}
+
+TEST(EditLog, TornRecordIsDropped) {
+    TempFile log("torn.log");
+    const std::string &path = log.path;
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 0, "abc");
+        writer.logInsert(0, 3, "def");
+    }
+    std::filesystem::resize_file(path, std::filesystem::file_size(path) - 2);
+
+    PieceTree tree;
+    std::string added;
+    ASSERT_EQ(EditLog::replay(EditLog::Reader::readFile(path), tree, added), 1);
+
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 3, "ghi");
+    }
+    PieceTree reopened;
+    added.clear();
+    ASSERT_EQ(EditLog::replay(EditLog::Reader::readFile(path), reopened, added), 2);
+    ASSERT_EQ(Util::textOf(reopened, "", added), "abcghi");
+}
+
+TEST(EditLog, GarbageTailIsDropped) {
+    TempFile log("garbage.log");
+    const std::string &path = log.path;
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 0, "abc");
+    }
+    // a crash may leave zero-filled blocks or garbage after the last complete record
+    std::ofstream(path, std::ios::binary | std::ios::app) << std::string(3, '\0') << "\x7fgarbage";
+    PieceTree corrupted;
+    std::string added;
+    ASSERT_THROW(EditLog::replay(EditLog::Reader::readFile(path), corrupted, added), PieceTreeException);
+
+    // reopening for writing cuts the log back to the last complete record
+    {
+        EditLog::Writer writer(path);
+        writer.logInsert(0, 3, "def");
+    }
+    PieceTree tree;
+    added.clear();
+    ASSERT_EQ(EditLog::replay(EditLog::Reader::readFile(path), tree, added), 2);
+    ASSERT_EQ(Util::textOf(tree, "", added), "abcdef");
+}
+
+TEST(EditLog, GroupCommit) {
+    TempFile log("group.log");
+    const std::string &path = log.path;
+    EditLog::Writer writer(path, 64);
+    writer.logInsert(0, 0, "short");
+    ASSERT_GT(writer.buffered(), 0);
+    ASSERT_EQ(std::filesystem::file_size(path), 0);
+
+    writer.logInsert(0, 5, std::string(100, 'x'));
+    ASSERT_EQ(writer.buffered(), 0);
+    ASSERT_GT(std::filesystem::file_size(path), 100);
+}
+
+TEST(EditLog, ForeignFileIsRejected) {
+    TempFile log("foreign.log");
+    const std::string &path = log.path;
+    std::ofstream(path) << "not a log";
+    ASSERT_THROW(EditLog::Writer writer(path), PieceTreeException);
+    ASSERT_EQ(std::filesystem::file_size(path), 9);
+}
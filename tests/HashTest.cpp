@@ -0,0 +1,94 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+std::uint64_t hashOf(const std::string &text) { return PieceTree::Hash::of(text).value; }
+} // namespace
+
+TEST(PieceTreeHash, SameTextDifferentPieces) {
+    Buffers b{"abc\ndef", "xyz"};
+
+    PieceTree whole;
+    whole.setTextSource(b.source());
+    whole.insert({NodeType::Original, 0, 7, {3}}, 0, 0);
+
+    PieceTree parts;
+    parts.setTextSource(b.source());
+    parts.insert({NodeType::Original, 4, 3, {}}, 0, 0);
+    parts.insert({NodeType::Original, 0, 4, {3}}, 0, 0);
+
+    ASSERT_EQ(whole.contentHash(), parts.contentHash());
+    ASSERT_EQ(whole.contentHash(), hashOf("abc\ndef"));
+
+    parts.insert({NodeType::Added, 0, 3, {}}, 1, 1);
+    ASSERT_EQ(parts.contentHash(), hashOf("abc\ndxyzef"));
+
+    parts.remove(1, 1, 3);
+    ASSERT_EQ(parts.contentHash(), whole.contentHash());
+}
+
+TEST(PieceTreeHash, RangeHash) {
+    Buffers b{"", ""};
+    PieceTree tree;
+    tree.setTextSource(b.source());
+
+    std::string text;
+    // many small pieces, so the tree rotates a lot while growing
+    for (int i = 0; i < 200; i++) {
+        std::string piece = std::to_string(i) + (i % 7 == 0 ? "\n" : " ");
+        PieceTree::Piece p = PieceTree::Piece::fromText(NodeType::Added, b.added.size(), piece);
+        b.added += piece;
+        tree.insert(p, 0, 0);
+        text.insert(0, piece);
+    }
+
+    ASSERT_EQ(tree.contentHash(), hashOf(text));
+    ASSERT_EQ(tree.rangeHash(0, 0), 0);
+    ASSERT_EQ(tree.rangeHash(13, 401), hashOf(text.substr(13, 388)));
+    ASSERT_EQ(tree.rangeHash(200, text.size()), hashOf(text.substr(200)));
+    ASSERT_THROW((void)tree.rangeHash(1, text.size() + 1), PieceTreeException);
+}
+
+TEST(PieceTreeHash, AttachSourceLater) {
+    Buffers b{"hello\nworld", ""};
+    PieceTree tree;
+    tree.insert({NodeType::Original, 6, 5, {}}, 0, 0);
+    tree.insert({NodeType::Original, 0, 6, {5}}, 0, 0);
+
+    ASSERT_THROW((void)tree.contentHash(), PieceTreeException);
+
+    tree.setTextSource(b.source());
+    ASSERT_EQ(tree.contentHash(), hashOf("hello\nworld"));
+}
+
+TEST(PieceTreeHash, SplitAndPartialPieces) {
+    Buffers b{"", ""};
+    for (int i = 0; i < 1000; i++)
+        b.original += static_cast<char>('a' + i % 23) + std::string(i % 31 == 0 ? "\n" : "");
+    PieceTree tree;
+    tree.setTextSource(b.source());
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, b.original), 0, 0);
+
+    // ranges inside the single piece, shorter and longer than half of it
+    ASSERT_EQ(tree.rangeHash(10, 20), hashOf(b.original.substr(10, 10)));
+    ASSERT_EQ(tree.rangeHash(3, 990), hashOf(b.original.substr(3, 987)));
+
+    // splits with the shorter half on either side
+    std::string text = b.original;
+    for (PieceTree::Offset at : {900, 17, 450, 451}) {
+        b.added += "#";
+        PieceTree::Offset line = tree.lineAt(at);
+        tree.insert(PieceTree::Piece::fromText(NodeType::Added, b.added.size() - 1, "#"), line,
+                    at - tree.lineStartOffset(line));
+        text.insert(at, "#");
+        ASSERT_EQ(tree.contentHash(), hashOf(text));
+        tree.checkInvariants();
+    }
+    PieceTree::Offset line = tree.lineAt(5);
+    tree.remove(line, 5 - tree.lineStartOffset(line), 300);
+    text.erase(5, 300);
+    ASSERT_EQ(tree.contentHash(), hashOf(text));
+    tree.checkInvariants();
+}
@@ -0,0 +1,66 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+namespace {
+PieceTree::Offset columnOf(const PieceTree &tree, PieceTree::Offset offset, PieceTree::Offset line) {
+    return offset - tree.lineStartOffset(line);
+}
+} // namespace
+
+TEST(Invariants, RandomEdits) {
+    for (unsigned seed = 1; seed <= 5; seed++) {
+        std::mt19937 rng(seed);
+        Buffers b;
+        std::string text;
+        PieceTree tree;
+        tree.setTextSource(b.source());
+
+        for (int i = 0; i < 1500; i++) {
+            switch (rng() % 6) {
+            case 4: {
+                // large cut and paste to exercise split and join
+                PieceTree::Offset offset = rng() % (text.size() + 1);
+                if (offset == static_cast<PieceTree::Offset>(text.size()))
+                    break;
+                PieceTree::Offset count = 1 + rng() % (text.size() - offset);
+                PieceTree::Offset line = tree.lineAt(offset);
+                PieceTree cut = tree.extract(line, columnOf(tree, offset, line), count);
+                std::string moved = text.substr(offset, count);
+                text.erase(offset, count);
+                PieceTree::Offset target = rng() % (text.size() + 1);
+                PieceTree::Offset target_line = tree.lineAt(target);
+                tree.insertTree(target_line, columnOf(tree, target, target_line), std::move(cut));
+                text.insert(target, moved);
+                break;
+            }
+            case 5: {
+                std::string appended = Util::randomText(rng, 1 + rng() % 12);
+                tree.append(b.add(appended));
+                text += appended;
+                break;
+            }
+            default:
+                Util::randomEdit(rng, tree, text, b.added, 40, 12);
+            }
+            ASSERT_NO_THROW(tree.checkInvariants()) << "seed " << seed << " step " << i;
+        }
+        ASSERT_EQ(Util::textOf(tree, "", b.added), text);
+    }
+}
+
+TEST(Invariants, BulkBuildAndClone) {
+    std::mt19937 rng(4);
+    std::vector<PieceTree::Piece> pieces;
+    std::string added;
+    for (int i = 0; i < 1000; i++) {
+        std::string text = Util::randomText(rng, 1 + rng() % 20);
+        pieces.push_back(PieceTree::Piece::fromText(NodeType::Added, added.size(), text));
+        added += text;
+    }
+    PieceTree tree = PieceTree::fromPieces(std::move(pieces));
+    ASSERT_NO_THROW(tree.checkInvariants());
+    ASSERT_NO_THROW(tree.clone().checkInvariants());
+}
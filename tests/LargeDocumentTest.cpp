@@ -0,0 +1,107 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <fcntl.h>
+#include <filesystem>
+#include <gtest/gtest.h>
+#include <string>
+#include <sys/mman.h>
+#include <unistd.h>
+
+// documents over 4 GiB need 64-bit offsets, the constants below do not even fit a 32-bit build
+#ifndef PIECETREE_32BIT_OFFSETS
+namespace {
+constexpr PieceTree::Offset GiB = PieceTree::Offset{1} << 30;
+
+// five 1 GiB chunks of one mapped file, every chunk ends with '\n'
+void loadChunks(PieceTree &tree) {
+    for (PieceTree::Offset chunk = 0; chunk < 5; chunk++) {
+        PieceTree::Piece p{NodeType::Original, chunk * GiB, GiB, {GiB - 1}};
+        tree.insert(p, chunk, 0);
+    }
+}
+} // namespace
+
+TEST(PieceTreeLargeDocument, ChunksOver4GiB) {
+    PieceTree tree;
+    loadChunks(tree);
+
+    ASSERT_EQ(tree.metrics().length, 5 * GiB);
+    ASSERT_EQ(tree.metrics().line_breaks, 5);
+
+    std::vector<const PieceTree::Piece *> pieces = tree.getLinePieces(4);
+    ASSERT_EQ(pieces.size(), 1);
+    ASSERT_EQ(pieces[0]->offset, 4 * GiB);
+}
+
+TEST(PieceTreeLargeDocument, EditBeyond4GiB) {
+    PieceTree tree;
+    loadChunks(tree);
+
+    PieceTree::Piece added{NodeType::Added, 0, 3, {}};
+    tree.insert(added, 4, 10);
+    /*
+        ... "chunk 4 [0, 10)" "abc" "chunk 4 [10, GiB)"
+    */
+
+    // joins line 3 and 4 by removing the end of chunk 3 together with its '\n'
+    tree.remove(3, GiB - 5, 10);
+
+    std::vector<PieceTree::Piece> pieces = Util::collectPieces(tree);
+
+    ASSERT_EQ(pieces.size(), 7);
+    ASSERT_EQ(pieces[3].offset, 3 * GiB);
+    ASSERT_EQ(pieces[3].length, GiB - 5);
+    ASSERT_TRUE(pieces[3].line_breaks.empty());
+    ASSERT_EQ(pieces[4].offset, 4 * GiB + 5);
+    ASSERT_EQ(pieces[4].length, 5);
+    ASSERT_EQ(pieces[5].length, 3);
+    ASSERT_EQ(pieces[6].offset, 4 * GiB + 10);
+
+    ASSERT_EQ(tree.metrics().length, 5 * GiB + 3 - 10);
+    ASSERT_EQ(tree.metrics().line_breaks, 4);
+    ASSERT_EQ(tree.convertColumn(3, GiB, PositionUnit::Byte, PositionUnit::CodePoint), GiB);
+}
+TEST(PieceTreeLargeDocument, MappedChunksOver4GiB) {
+    // a sparse 5 GiB file with a line break closing every 8 MiB chunk, mapped and opened without scanning it
+    constexpr PieceTree::Offset chunk = 8 << 20, chunks = 5 * GiB / chunk;
+    std::string path = (std::filesystem::temp_directory_path() /
+                        ("piecetree_mapped_" + std::to_string(::getpid()) + ".txt")).string();
+    int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    ASSERT_GE(fd, 0);
+    ASSERT_EQ(::ftruncate(fd, 5 * GiB), 0);
+    for (PieceTree::Offset i = 1; i <= chunks; i++)
+        ASSERT_EQ(::pwrite(fd, "\n", 1, i * chunk - 1), 1);
+    void *mapping = ::mmap(nullptr, 5 * GiB, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    ASSERT_NE(mapping, MAP_FAILED);
+    std::string_view original(static_cast<const char *>(mapping), 5 * GiB);
+
+    std::vector<PieceTree::Piece> pieces;
+    for (PieceTree::Offset i = 0; i < chunks; i++)
+        pieces.push_back(PieceTree::Piece::unindexed(NodeType::Original, i * chunk, chunk, 1));
+    PieceTree tree = PieceTree::fromPieces(std::move(pieces));
+    std::string added = "abc";
+    tree.setTextSource([&](const PieceTree::Piece &p) {
+        return (p.type == NodeType::Original ? original : std::string_view(added)).substr(p.offset, p.length);
+    });
+
+    // line 600 starts past 4 GiB, only the chunks the lookups and the edit land in are scanned
+    PieceTree::Offset line = 600;
+    ASSERT_EQ(tree.lineStartOffset(line), line * chunk);
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, added), line, 10);
+    ASSERT_EQ(tree.metrics().length, 5 * GiB + 3);
+    ASSERT_EQ(tree.metrics().line_breaks, chunks);
+    ASSERT_GE(tree.metrics().unindexed, chunks - 2);
+    ASSERT_EQ(tree.lineAt(line * chunk + 12), line);
+
+    std::vector<const PieceTree::Piece *> line_pieces = tree.getLinePieces(line);
+    ASSERT_EQ(line_pieces.size(), 3);
+    ASSERT_EQ(line_pieces[0]->offset, line * chunk);
+    ASSERT_EQ(line_pieces[0]->length, 10);
+    ASSERT_EQ(line_pieces[1]->type, NodeType::Added);
+    ASSERT_EQ(line_pieces[2]->offset, line * chunk + 10);
+
+    ::munmap(mapping, 5 * GiB);
+    std::filesystem::remove(path);
+}
+#endif // PIECETREE_32BIT_OFFSETS
@@ -0,0 +1,98 @@
+#include "../include/LineIndexer.h"
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+// an Original buffer split into unindexed chunks, as a file is opened without scanning it
+struct LazyDocument {
+    std::string original;
+    int reads = 0;
+    PieceTree tree;
+
+    explicit LazyDocument(int lines, PieceTree::Offset chunk_size) {
+        for (int i = 0; i < lines; i++)
+            original += "line " + std::to_string(i) + (i % 3 == 0 ? " ü\n" : "\n");
+
+        std::vector<PieceTree::Piece> chunks;
+        for (PieceTree::Offset at = 0, length; at < static_cast<PieceTree::Offset>(original.size()); at += length) {
+            length = std::min<PieceTree::Offset>(chunk_size, original.size() - at);
+            // chunks end on character boundaries
+            while ((original[at + length - 1] & 0xc0) == 0xc0)
+                length--;
+            chunks.push_back(PieceTree::Piece::unindexed(NodeType::Original, at, length, length / 8));
+        }
+        tree = PieceTree::fromPieces(std::move(chunks));
+        tree.setTextSource([this](const PieceTree::Piece &p) {
+            reads++;
+            return std::string_view(original).substr(p.offset, p.length);
+        });
+    }
+
+    PieceTree::Offset exactLineStart(int number) {
+        return original.find("line " + std::to_string(number) + (number % 3 == 0 ? " ü\n" : "\n"));
+    }
+};
+} // namespace
+
+TEST(LazyIndex, FirstScreenScansOnlyFirstChunk) {
+    LazyDocument doc(100000, 64 * 1024);
+    ASSERT_FALSE(doc.tree.fullyIndexed());
+    PieceTree::Offset chunks = doc.tree.metrics().unindexed;
+
+    ASSERT_EQ(doc.reads, 0); // attaching the source read nothing
+
+    for (int i = 0; i < 50; i++)
+        ASSERT_EQ(doc.tree.lineStartOffset(i), doc.exactLineStart(i));
+    ASSERT_EQ(doc.tree.metrics().unindexed, chunks - 1);
+    ASSERT_EQ(doc.reads, 2); // scanned and hashed
+    ASSERT_THROW((void)doc.tree.contentHash(), PieceTreeException);
+}
+
+TEST(LazyIndex, LinesBecomeExactOnceIndexed) {
+    LazyDocument doc(20000, 4096);
+    // far down the file lines only land in a real line start
+    PieceTree::Offset approximate = doc.tree.lineStartOffset(15000);
+    ASSERT_TRUE(approximate == 0 || doc.original[approximate - 1] == '\n');
+
+    LineIndexer indexer([&](const PieceTree::Piece &p) { return std::string_view(doc.original).substr(p.offset, p.length); });
+    indexer.schedule(doc.tree);
+    indexer.wait();
+    ASSERT_GT(indexer.apply(doc.tree), 0);
+    ASSERT_TRUE(doc.tree.fullyIndexed());
+
+    ASSERT_EQ(doc.tree.metrics().line_breaks, 20000);
+    ASSERT_EQ(doc.tree.contentHash(), PieceTree::Hash::of(doc.original).value);
+    ASSERT_EQ(doc.tree.lineStartOffset(15000), doc.exactLineStart(15000));
+    ASSERT_EQ(doc.tree.convertOffset(doc.original.size(), PositionUnit::Byte, PositionUnit::CodePoint),
+              doc.original.size() - (20000 + 2) / 3);
+}
+
+TEST(LazyIndex, EditsInsideUnindexedChunks) {
+    LazyDocument doc(1000, 1024);
+    std::string added = "X\n";
+    doc.tree.setTextSource([&](const PieceTree::Piece &p) {
+        const std::string &buffer = p.type == NodeType::Original ? doc.original : added;
+        return std::string_view(buffer).substr(p.offset, p.length);
+    });
+
+    // edits resolve lines the same way lookups do, exact or not
+    std::string expected = doc.original;
+    PieceTree::Offset insert_at = doc.tree.lineStartOffset(500) + 2;
+    doc.tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, added), 500, 2);
+    expected.insert(insert_at, added);
+    PieceTree::Offset remove_at = doc.tree.lineStartOffset(700);
+    doc.tree.remove(700, 0, 5);
+    expected.erase(remove_at, 5);
+
+    LineIndexer indexer([&](const PieceTree::Piece &p) { return std::string_view(doc.original).substr(p.offset, p.length); });
+    indexer.schedule(doc.tree);
+    indexer.wait();
+    indexer.apply(doc.tree);
+    ASSERT_TRUE(doc.tree.fullyIndexed());
+
+    std::string text;
+    for (auto &piece : doc.tree)
+        text += (piece.type == NodeType::Original ? doc.original : added).substr(piece.offset, piece.length);
+    ASSERT_EQ(text, expected);
+    ASSERT_EQ(doc.tree.metrics().line_breaks, 1001);
+}
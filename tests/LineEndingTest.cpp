@@ -0,0 +1,91 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+namespace {
+PieceTree::LineEndings count(const std::string &text) {
+    PieceTree::LineEndings endings;
+    for (std::size_t i = 0; i < text.size(); i++) {
+        if (text[i] == '\r' && i + 1 < text.size() && text[i + 1] == '\n') {
+            endings.crlf++;
+            i++;
+        } else if (text[i] == '\r') {
+            endings.cr++;
+        } else if (text[i] == '\n') {
+            endings.lf++;
+        }
+    }
+    return endings;
+}
+
+PieceTree treeOf(const std::string &text) {
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, text), 0, 0);
+    return tree;
+}
+} // namespace
+
+TEST(LineEndings, Dominant) {
+    ASSERT_EQ(PieceTree().dominantLineEnding(), LineEnding::Lf);
+    ASSERT_EQ(treeOf("a\nb\r\nc\n").dominantLineEnding(), LineEnding::Lf);
+    ASSERT_EQ(treeOf("a\r\nb\r\nc\n").dominantLineEnding(), LineEnding::CrLf);
+    ASSERT_EQ(treeOf("a\rb\rc\r\n").dominantLineEnding(), LineEnding::Cr);
+
+    // SIMD blocks and the scalar tail agree
+    PieceTree long_lines = treeOf(std::string(40, 'x') + "\r\n" + std::string(30, 'y') + "\r\n\r\r");
+    PieceTree::LineEndings endings = long_lines.lineEndings();
+    ASSERT_EQ(endings.crlf, 2);
+    ASSERT_EQ(endings.cr, 2);
+    ASSERT_EQ(endings.lf, 0);
+    ASSERT_EQ(long_lines.metrics().line_breaks, 2);
+}
+
+TEST(LineEndings, CrLfAcrossPieces) {
+    std::string added;
+    PieceTree tree;
+    auto insert = [&](const std::string &text, PieceTree::Offset line, PieceTree::Offset column) {
+        tree.insert(PieceTree::Piece::fromText(NodeType::Added, added.size(), text), line, column);
+        added += text;
+    };
+
+    insert("one\r", 0, 0);
+    insert("\ntwo", 0, 4);
+    ASSERT_EQ(tree.lineEndings().crlf, 1);
+    ASSERT_EQ(tree.lineEndings().cr, 0);
+    ASSERT_EQ(tree.lineEndings().lf, 0);
+    ASSERT_EQ(tree.metrics().line_breaks, 1);
+
+    // typing between CR and LF separates them, removing the text joins them again
+    insert("x", 0, 4);
+    ASSERT_EQ(tree.lineEndings().crlf, 0);
+    ASSERT_EQ(tree.lineEndings().cr, 1);
+    ASSERT_EQ(tree.lineEndings().lf, 1);
+    tree.remove(0, 4, 1);
+    ASSERT_EQ(tree.lineEndings().crlf, 1);
+
+    // splitting a piece inside its CR LF keeps the pair
+    PieceTree split = treeOf("a\r\nb");
+    split.insert(PieceTree::Piece::fromText(NodeType::Added, 0, ""), 0, 2);
+    ASSERT_EQ(split.lineEndings().crlf, 1);
+    PieceTree cut = split.extract(0, 2, 2);
+    ASSERT_EQ(cut.lineEndings().crlf, 0);
+    ASSERT_EQ(cut.lineEndings().lf, 1);
+    ASSERT_EQ(split.lineEndings().cr, 1);
+}
+
+TEST(LineEndings, RandomEdits) {
+    std::mt19937 rng(17);
+    std::string added, text;
+    PieceTree tree;
+
+    for (int i = 0; i < 2000; i++) {
+        Util::randomEdit(rng, tree, text, added, 8, 6, "ab\r\n");
+        PieceTree::LineEndings expected = count(text), actual = tree.lineEndings();
+        ASSERT_EQ(actual.lf, expected.lf) << "step " << i;
+        ASSERT_EQ(actual.crlf, expected.crlf) << "step " << i;
+        ASSERT_EQ(actual.cr, expected.cr) << "step " << i;
+    }
+    ASSERT_NO_THROW(tree.checkInvariants());
+}
@@ -0,0 +1,61 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <algorithm>
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+namespace {
+// the CR of a CR LF does not count, a lone CR does
+PieceTree::Offset longestLine(const std::string &text) {
+    PieceTree::Offset longest = 0;
+    std::size_t start = 0;
+    for (std::size_t end; (end = text.find('\n', start)) != std::string::npos; start = end + 1)
+        longest = std::max<PieceTree::Offset>(longest, end - start - (end > start && text[end - 1] == '\r'));
+    return std::max<PieceTree::Offset>(longest, text.size() - start);
+}
+} // namespace
+
+TEST(MaxLineLength, LinesSpanningPieces) {
+    std::string added;
+    PieceTree tree;
+    ASSERT_EQ(tree.maxLineLength(), 0);
+
+    auto append = [&](const std::string &text) {
+        tree.append(PieceTree::Piece::fromText(NodeType::Added, added.size(), text));
+        added += text;
+    };
+    append("short\nab");
+    append("cdefgh");
+    append("ij\nx");
+    ASSERT_EQ(tree.maxLineLength(), 10); // "abcdefghij" is built from three pieces
+
+    tree.remove(1, 2, 6);
+    ASSERT_EQ(tree.maxLineLength(), 5);
+
+    append("\n" + std::string(40, 'y'));
+    ASSERT_EQ(tree.maxLineLength(), 40);
+}
+
+TEST(MaxLineLength, RandomEdits) {
+    std::mt19937 rng(11);
+    std::string added, text;
+    PieceTree tree;
+
+    for (int i = 0; i < 2000; i++) {
+        Util::randomEdit(rng, tree, text, added, 30, 20);
+        ASSERT_EQ(tree.maxLineLength(), longestLine(text));
+    }
+}
+
+TEST(MaxLineLength, RandomEditsWithCrLf) {
+    std::mt19937 rng(12);
+    std::string added, text;
+    PieceTree tree;
+
+    for (int i = 0; i < 2000; i++) {
+        Util::randomEdit(rng, tree, text, added, 10, 8, "abc\r\n");
+        ASSERT_EQ(tree.maxLineLength(), longestLine(text)) << "step " << i;
+    }
+    ASSERT_NO_THROW(tree.checkInvariants());
+}
@@ -0,0 +1,86 @@
+#include "../include/LogFollower.h"
+#include "Util.h"
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+#include <thread>
+
+namespace {
+void write(const std::string &path, std::string_view text, std::ios::openmode mode = std::ios::app) {
+    std::ofstream(path, std::ios::binary | mode) << text;
+}
+
+std::string textOf(PieceTree &tree, const LogFollower &follower) {
+    std::string text;
+    for (auto &piece : tree)
+        text += follower.text(piece);
+    return text;
+}
+} // namespace
+
+TEST(LogFollower, AppendsWhatIsWritten) {
+    TempFile file("follow.log");
+    const std::string &path = file.path;
+    write(path, "first\nsec", std::ios::trunc);
+
+    PieceTree tree;
+    LogFollower follower(path, tree);
+    tree.setTextSource([&](const PieceTree::Piece &piece) { return follower.text(piece); });
+    ASSERT_EQ(follower.poll(), 9);
+    ASSERT_EQ(follower.poll(), 0);
+
+    write(path, "ond\nthird\n");
+    ASSERT_EQ(follower.poll(), 10);
+    ASSERT_EQ(textOf(tree, follower), "first\nsecond\nthird\n");
+    ASSERT_EQ(tree.metrics().line_breaks, 3);
+    ASSERT_EQ(tree.metrics().pieces, 1); // the second write extended the first piece
+    ASSERT_EQ(tree.contentHash(), PieceTree::Hash::of("first\nsecond\nthird\n").value);
+
+    // beyond the first page
+    std::string more(10000, 'x');
+    write(path, more);
+    ASSERT_EQ(follower.poll(), 10000);
+    ASSERT_EQ(tree.maxLineLength(), 10000);
+    ASSERT_EQ(textOf(tree, follower), "first\nsecond\nthird\n" + more);
+}
+
+TEST(LogFollower, WaitsForCompleteCharacters) {
+    TempFile file("follow_utf8.log");
+    const std::string &path = file.path;
+    write(path, "price \xE2\x82", std::ios::trunc);
+
+    PieceTree tree;
+    LogFollower follower(path, tree);
+    ASSERT_EQ(follower.poll(), 6);
+
+    write(path, "\xAC\n");
+    ASSERT_EQ(follower.poll(), 4);
+    ASSERT_EQ(tree.metrics().code_points, 8);
+    ASSERT_EQ(textOf(tree, follower), "price €\n");
+}
+
+TEST(LogFollower, WaitAndTruncation) {
+    TempFile file("follow_wait.log");
+    const std::string &path = file.path;
+    write(path, "", std::ios::trunc);
+
+    PieceTree tree;
+    LogFollower follower(path, tree);
+    std::jthread writer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        write(path, "line\n");
+    });
+    PieceTree::Offset appended = 0;
+    for (int i = 0; i < 100 && appended == 0; i++)
+        appended += follower.wait(std::chrono::milliseconds(100));
+    ASSERT_EQ(appended, 5);
+
+    write(path, "", std::ios::trunc);
+    ASSERT_THROW(follower.poll(), PieceTreeException);
+}
+
+TEST(LogFollower, MissingFile) {
+    PieceTree tree;
+    TempFile missing("no_such.log");
+    ASSERT_THROW(LogFollower(missing.path, tree), PieceTreeException);
+}
@@ -0,0 +1,79 @@
+#include "../include/MarkerTree.h"
+#include <gtest/gtest.h>
+
+TEST(PieceTreeMarkers, FollowInsertAndRemove) {
+    PieceTree tree;
+    tree.insert({NodeType::Added, 0, 8, {3}}, 0, 0); // "abc\ndefg"
+
+    MarkerTree::MarkerId e = tree.markers().add(5, 5);  // at 'e'
+    MarkerTree::MarkerId bc = tree.markers().add(1, 3); // "bc\n"
+
+    tree.insert({NodeType::Added, 8, 2, {}}, 0, 0); // "xy" before everything
+    ASSERT_EQ(tree.markers().get(e)->start, 7);
+    ASSERT_EQ(tree.markers().get(bc)->start, 3);
+    ASSERT_EQ(tree.markers().get(bc)->end, 5);
+
+    tree.remove(0, 4, 3); // "c\nd" -> "xyabefg"
+    ASSERT_EQ(tree.markers().get(e)->start, 4);
+    ASSERT_EQ(tree.markers().get(e)->end, 4);
+    ASSERT_EQ(tree.markers().get(bc)->start, 3);
+    ASSERT_EQ(tree.markers().get(bc)->end, 4);
+
+    tree.remove(0, 0, 6);
+    ASSERT_EQ(tree.markers().get(e)->start, 0);
+    ASSERT_EQ(tree.markers().get(bc)->end, 0);
+}
+
+TEST(PieceTreeMarkers, Stickiness) {
+    PieceTree tree;
+    tree.insert({NodeType::Added, 0, 6, {}}, 0, 0); // "abcdef"
+
+    MarkerTree &markers = tree.markers();
+    MarkerTree::MarkerId never = markers.add(2, 4, MarkerTree::Stickiness::NeverGrows);
+    MarkerTree::MarkerId always = markers.add(2, 4, MarkerTree::Stickiness::AlwaysGrows);
+    MarkerTree::MarkerId before = markers.add(2, 4, MarkerTree::Stickiness::GrowsBefore);
+    MarkerTree::MarkerId cursor = markers.add(4, 4, MarkerTree::Stickiness::NeverGrows);
+
+    tree.insert({NodeType::Added, 6, 1, {}}, 0, 2); // at the start of the ranges
+    tree.insert({NodeType::Added, 7, 1, {}}, 0, 5); // at the end of the ranges
+
+    ASSERT_EQ(markers.get(never)->start, 3);
+    ASSERT_EQ(markers.get(never)->end, 5);
+    ASSERT_EQ(markers.get(always)->start, 2);
+    ASSERT_EQ(markers.get(always)->end, 6);
+    ASSERT_EQ(markers.get(before)->start, 2);
+    ASSERT_EQ(markers.get(before)->end, 5);
+    // a cursor is pushed forward by typing at it
+    ASSERT_EQ(markers.get(cursor)->start, 6);
+    ASSERT_EQ(markers.get(cursor)->end, 6);
+}
+
+TEST(PieceTreeMarkers, ViewportQuery) {
+    PieceTree tree;
+    // 100 lines "xxx\n"
+    for (int i = 0; i < 100; i++) {
+        tree.insert({NodeType::Added, i * 4, 4, {3}}, i, 0);
+    }
+
+    MarkerTree &markers = tree.markers();
+    for (int i = 0; i < 100; i++) {
+        markers.add(i * 4 + 1, i * 4 + 1);
+    }
+    MarkerTree::MarkerId spanning = markers.add(10, 300); // lines 2..75
+
+    std::vector<MarkerTree::Marker> visible = markers.markersInRange(tree, 40, 44);
+    ASSERT_EQ(visible.size(), 6);
+    ASSERT_EQ(visible[0].id, spanning);
+    ASSERT_EQ(visible[1].start, 40 * 4 + 1);
+
+    // typing a line at the top shifts everything below by one line
+    tree.insert({NodeType::Added, 400, 4, {3}}, 0, 0);
+    visible = markers.markersInRange(tree, 41, 45);
+    ASSERT_EQ(visible.size(), 6);
+    ASSERT_EQ(visible[1].start, 41 * 4 + 1);
+
+    ASSERT_TRUE(markers.erase(spanning));
+    ASSERT_FALSE(markers.erase(spanning));
+    ASSERT_EQ(markers.markersInRange(tree, 41, 45).size(), 5);
+    ASSERT_EQ(markers.size(), 100);
+}
@@ -0,0 +1,95 @@
+#include "../include/BufferStore.h"
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <random>
+#include <string>
+
+TEST(MemoryUsage, Breakdown) {
+    std::string original = "one\ntwo\nthree\n", added;
+    PieceTree tree;
+    ASSERT_EQ(tree.memoryUsage().pieces, 0);
+
+    tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, original), 0, 0);
+    for (const char *text : {"abc\n", "de\nf", "ghij"}) {
+        tree.insert(PieceTree::Piece::fromText(NodeType::Added, added.size(), text), 1, 0);
+        added += text;
+    }
+    tree.remove(0, 0, 4); // drops "one\n" from the Original buffer
+
+    auto usage = tree.memoryUsage(added.size());
+    ASSERT_EQ(usage.pieces, 4);
+    ASSERT_GE(usage.node_bytes, usage.pieces * sizeof(PieceTree::Piece));
+    ASSERT_GE(usage.line_break_bytes, 4 * sizeof(PieceTree::Offset));
+    ASSERT_EQ(usage.live_original_bytes, original.size() - 4);
+    ASSERT_EQ(usage.live_added_bytes, added.size());
+    ASSERT_EQ(usage.dead_added_bytes, 0);
+
+    tree.remove(0, 0, 6); // "ghijde" from the Added buffer
+    usage = tree.memoryUsage(added.size() + 100);
+    ASSERT_EQ(usage.live_added_bytes, added.size() - 6);
+    ASSERT_EQ(usage.dead_added_bytes, 106);
+}
+
+TEST(MemoryUsage, SharedBufferTreesShareTheirIndex) {
+    BufferStore store;
+    auto document = [](int lines) {
+        std::string contents;
+        for (int i = 0; i < lines; i++)
+            contents += "line " + std::to_string(i) + " \xc3\xa9\r\n";
+        return contents;
+    };
+    auto small = store.intern(document(10));
+    auto large = store.intern(document(1000));
+    const PieceTree::Piece &index = large->index();
+
+    // pieces copied from the index refer to its tables, neither they nor the text are copied, so every tree
+    // costs one node whatever the size of the buffer
+    PieceTree first = large->makeTree();
+    PieceTree second = large->makeTree();
+    std::size_t tables = (index.line_breaks.size() + index.carriage_returns.size()) * sizeof(PieceTree::Offset) +
+                         index.multibyte_chars.size() * sizeof(PieceTree::MultibyteChar);
+    for (PieceTree *tree : {&first, &second}) {
+        auto usage = tree->memoryUsage();
+        ASSERT_EQ(usage.line_break_bytes + usage.multibyte_bytes, 0);
+        ASSERT_EQ(usage.shared_bytes, tables);
+        ASSERT_EQ(usage.treeBytes(), usage.node_bytes);
+        ASSERT_EQ(tree->begin()->line_breaks.data(), index.line_breaks.data());
+    }
+    ASSERT_EQ(second.memoryUsage().treeBytes(), small->makeTree().memoryUsage().treeBytes());
+
+    // an edit gives the tree tables of its own, the index is left as it was
+    second.insert(PieceTree::Piece::fromText(NodeType::Added, 0, "x"), 500, 2);
+    ASSERT_GT(second.memoryUsage().line_break_bytes, 0);
+    ASSERT_EQ(first.memoryUsage().shared_bytes, tables);
+    ASSERT_EQ(index.line_breaks.size(), 1000);
+}
+
+TEST(MemoryUsage, ShrinkToFit) {
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, std::string(100, '\n')), 0, 0);
+    tree.remove(3, 0, 97); // truncating the piece keeps the capacity of its line break table
+    ASSERT_GT(tree.memoryUsage().spare_bytes, 0);
+
+    std::size_t before = tree.memoryUsage().treeBytes();
+    tree.shrinkToFit();
+    ASSERT_EQ(tree.memoryUsage().spare_bytes, 0);
+    ASSERT_LT(tree.memoryUsage().treeBytes(), before);
+    ASSERT_EQ(tree.metrics().line_breaks, 3);
+}
+
+TEST(MemoryUsage, CompactAdded) {
+    std::mt19937 rng(5);
+    std::string added, text;
+    PieceTree tree;
+
+    for (int i = 0; i < 500; i++)
+        Util::randomEdit(rng, tree, text, added, 20);
+    ASSERT_GT(tree.memoryUsage(added.size()).dead_added_bytes, 0);
+
+    tree.compactAdded(added);
+    auto usage = tree.memoryUsage(added.size());
+    ASSERT_EQ(usage.dead_added_bytes, 0);
+    ASSERT_EQ(added.size(), text.size());
+    ASSERT_EQ(Util::textOf(tree, "", added), text);
+}
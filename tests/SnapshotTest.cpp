@@ -0,0 +1,129 @@
+#include "../include/Snapshot.h"
+#include "Util.h"
+#include <filesystem>
+#include <fstream>
+#include <gtest/gtest.h>
+#include <string>
+
+namespace {
+struct Document {
+    TempFile original_file{"snapshot_original.txt"};
+    std::string original_path = original_file.path;
+    std::string original = "first line\r\nsecond ✓ line\nthird\r\n";
+    std::string added;
+    PieceTree tree;
+
+    Document() {
+        std::ofstream(original_path, std::ios::binary) << original;
+        tree.insert(PieceTree::Piece::fromText(NodeType::Original, 0, original), 0, 0);
+        insert("naïve\n", 1, 0);
+        insert("€", 0, 5);
+        tree.remove(2, 2, 5);
+    }
+
+    void insert(std::string_view text, PieceTree::Offset line, PieceTree::Offset column) {
+        tree.insert(PieceTree::Piece::fromText(NodeType::Added, added.size(), text), line, column);
+        added += text;
+    }
+};
+} // namespace
+
+TEST(Snapshot, SaveAndRestore) {
+    Document doc;
+    TempFile snapshot_file("restore.snapshot");
+    const std::string &path = snapshot_file.path;
+    Snapshot::save(path, doc.tree, doc.added, Snapshot::OriginalFile::describe(doc.original_path, doc.original));
+
+    Snapshot::Mapped snapshot(path);
+    ASSERT_EQ(snapshot.original().path, doc.original_path);
+    ASSERT_EQ(snapshot.original().size, doc.original.size());
+    ASSERT_EQ(snapshot.original().hash, PieceTree::Hash::of(doc.original).value);
+    ASSERT_TRUE(snapshot.original().isCurrent());
+    ASSERT_EQ(snapshot.added(), doc.added);
+
+    PieceTree restored = snapshot.buildTree();
+    ASSERT_EQ(Util::textOf(restored, doc.original, snapshot.added()), Util::textOf(doc.tree, doc.original, doc.added));
+    PieceTree::Metrics expected = doc.tree.metrics(), actual = restored.metrics();
+    ASSERT_EQ(actual.length, expected.length);
+    ASSERT_EQ(actual.line_breaks, expected.line_breaks);
+    ASSERT_EQ(actual.code_points, expected.code_points);
+    ASSERT_EQ(actual.utf16_units, expected.utf16_units);
+    ASSERT_EQ(restored.lineStartOffset(2), doc.tree.lineStartOffset(2));
+    ASSERT_EQ(restored.lineEndings(), doc.tree.lineEndings());
+
+    // the restored tree is a regular tree
+    restored.remove(0, 0, 3);
+    ASSERT_EQ(restored.metrics().length, expected.length - 3);
+}
+
+TEST(Snapshot, ModifiedOriginalIsDetected) {
+    Document doc;
+    auto original = Snapshot::OriginalFile::describe(doc.original_path, doc.original);
+    std::ofstream(doc.original_path, std::ios::app) << "appended";
+    ASSERT_FALSE(original.isCurrent());
+}
+
+TEST(Snapshot, CorruptionIsRejected) {
+    Document doc;
+    TempFile snapshot_file("corrupt.snapshot");
+    const std::string &path = snapshot_file.path;
+    Snapshot::save(path, doc.tree, doc.added, Snapshot::OriginalFile::describe(doc.original_path, doc.original));
+
+    {
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(-3, std::ios::end);
+        file.put('\x7f');
+    }
+    ASSERT_THROW(Snapshot::Mapped snapshot(path), PieceTreeException);
+
+    std::ofstream(path, std::ios::binary) << "definitely not a snapshot file";
+    ASSERT_THROW(Snapshot::Mapped snapshot(path), PieceTreeException);
+}
+
+TEST(Snapshot, InconsistentPiecesAreRejected) {
+    Document doc;
+    TempFile snapshot_file("inconsistent.snapshot");
+    const std::string &path = snapshot_file.path;
+    auto original = Snapshot::OriginalFile::describe(doc.original_path, doc.original);
+
+    // the checksum matches, the pieces refer past the end of the buffers saved with them
+    Snapshot::save(path, doc.tree, doc.added.substr(0, 2), original);
+    ASSERT_THROW(Snapshot::Mapped(path).buildTree(), PieceTreeException);
+    auto truncated = original;
+    truncated.size = 4;
+    Snapshot::save(path, doc.tree, doc.added, truncated);
+    ASSERT_THROW(Snapshot::Mapped(path).buildTree(), PieceTreeException);
+
+    PieceTree::Piece piece = PieceTree::Piece::fromText(NodeType::Added, 0, "\xc3\xa9");
+    piece.multibyte_chars = {{0, 7}};
+    PieceTree wide = PieceTree::fromPieces({piece});
+    Snapshot::save(path, wide, "\xc3\xa9", original);
+    ASSERT_THROW(Snapshot::Mapped(path).buildTree(), PieceTreeException);
+}
+
+TEST(Snapshot, FailedSaveRemovesTemporary) {
+    Document doc;
+    // a directory in place of the snapshot makes the final rename fail
+    TempFile snapshot_file("snapshot_dir");
+    const std::string &path = snapshot_file.path;
+    std::filesystem::create_directories(path);
+    auto original = Snapshot::OriginalFile::describe(doc.original_path, doc.original);
+    ASSERT_THROW(Snapshot::save(path, doc.tree, doc.added, original), PieceTreeException);
+    ASSERT_FALSE(std::filesystem::exists(path + ".tmp"));
+}
+
+TEST(Snapshot, FromPiecesIsBalanced) {
+    std::string added;
+    std::vector<PieceTree::Piece> pieces;
+    for (int i = 0; i < 1000; i++) {
+        std::string text = std::to_string(i) + "\n";
+        pieces.push_back(PieceTree::Piece::fromText(NodeType::Added, added.size(), text));
+        added += text;
+    }
+
+    PieceTree tree = PieceTree::fromPieces(std::move(pieces));
+    ASSERT_EQ(tree.metrics().line_breaks, 1000);
+    ASSERT_EQ(Util::textOf(tree, "", added), added);
+    ASSERT_EQ(tree.lineStartOffset(500), added.find("500\n"));
+    ASSERT_EQ(tree.getLinePieces(999).size(), 1);
+}
@@ -0,0 +1,94 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+
+TEST(PieceTreeSplitJoin, ExtractRange) {
+    PieceTree tree;
+
+    PieceTree::Piece p1{NodeType::Added, 0, 4, {2}}; // "ab\nc"
+    PieceTree::Piece p2{NodeType::Added, 4, 3, {}};  // "def"
+    tree.insert(p1, 0, 0);
+    tree.insert(p2, 0, 1);
+    /*
+        "a" "def" "b\n
+         c"
+    */
+
+    PieceTree cut = tree.extract(0, 2, 3);
+    /*
+        tree: "a" "d" "\n
+               c"
+        cut:  "ef" "b"
+    */
+
+    std::vector<PieceTree::Piece> pieces = Util::collectPieces(tree);
+    ASSERT_EQ(pieces.size(), 3);
+    ASSERT_EQ(pieces[1].offset, 4);
+    ASSERT_EQ(pieces[1].length, 1);
+    ASSERT_EQ(pieces[2].length, 2);
+    ASSERT_EQ(pieces[2].line_breaks[0], 0);
+
+    std::vector<PieceTree::Piece> cut_pieces = Util::collectPieces(cut);
+    ASSERT_EQ(cut_pieces.size(), 2);
+    ASSERT_EQ(cut_pieces[0].offset, 5);
+    ASSERT_EQ(cut_pieces[0].length, 2);
+    ASSERT_EQ(cut_pieces[1].offset, 1);
+    ASSERT_EQ(cut_pieces[1].length, 1);
+    ASSERT_EQ(cut.metrics().length, 3);
+}
+
+TEST(PieceTreeSplitJoin, CutAndPaste) {
+    PieceTree tree;
+
+    PieceTree::Piece p1{NodeType::Added, 0, 8, {3, 7}}; // "abc\ndef\n"
+    tree.insert(p1, 0, 0);
+
+    PieceTree line = tree.extract(0, 0, 4); // "abc\n"
+    tree.insertTree(1, 0, std::move(line));
+    /*
+        "def\n" "abc\n"
+    */
+
+    std::vector<PieceTree::Piece> pieces = Util::collectPieces(tree);
+    ASSERT_EQ(pieces.size(), 2);
+    ASSERT_EQ(pieces[0].offset, 4);
+    ASSERT_EQ(pieces[1].offset, 0);
+    ASSERT_EQ(tree.metrics().line_breaks, 2);
+    ASSERT_EQ(Util::collectPieces(line).size(), 0);
+}
+
+TEST(PieceTreeSplitJoin, RemoveManyLines) {
+    PieceTree tree;
+
+    // 1000 one-line pieces "xxxx\n"
+    for (int i = 0; i < 1000; i++) {
+        PieceTree::Piece p{NodeType::Added, i * 5, 5, {4}};
+        tree.insert(p, i, 0);
+    }
+
+    // from the middle of line 10 to the middle of line 990
+    tree.remove(10, 2, 980 * 5);
+
+    std::vector<PieceTree::Piece> pieces = Util::collectPieces(tree);
+    ASSERT_EQ(pieces.size(), 21);
+    ASSERT_EQ(pieces[10].length, 2);
+    ASSERT_TRUE(pieces[10].line_breaks.empty());
+    ASSERT_EQ(pieces[11].offset, 990 * 5 + 2);
+    ASSERT_EQ(pieces[11].line_breaks[0], 2);
+    ASSERT_EQ(tree.metrics().line_breaks, 20);
+    ASSERT_EQ(tree.metrics().length, 20 * 5);
+}
+
+TEST(PieceTreeSplitJoin, RemoveEverything) {
+    PieceTree tree;
+
+    PieceTree::Piece p1{NodeType::Added, 0, 7, {3}}; // "abc\ndef"
+    tree.insert(p1, 0, 0);
+    tree.remove(0, 0, 7);
+
+    ASSERT_EQ(Util::collectPieces(tree).size(), 0);
+
+    PieceTree::Piece p2{NodeType::Added, 7, 2, {}};
+    tree.insert(p2, 0, 0);
+    ASSERT_EQ(tree.metrics().length, 2);
+}
@@ -0,0 +1,123 @@
+#include "../include/PieceTree.h"
+#include "Util.h"
+#include <gtest/gtest.h>
+#include <string>
+
+TEST(PieceTreeUtf8, FromTextCounts) {
+    // "aé\n€😀" : 1 + 2 + 1 + 3 + 4 bytes
+    std::string text = "a\xC3\xA9\n\xE2\x82\xAC\xF0\x9F\x98\x80";
+    PieceTree::Piece p = PieceTree::Piece::fromText(NodeType::Original, 0, text);
+
+    ASSERT_EQ(p.length, 11);
+    ASSERT_EQ(p.line_breaks.size(), 1);
+    ASSERT_EQ(p.line_breaks[0], 3);
+    ASSERT_EQ(p.multibyte_chars.size(), 3);
+
+    PieceTree::Metrics m = p.metricsBefore(p.length);
+    ASSERT_EQ(m.code_points, 5);
+    ASSERT_EQ(m.utf16_units, 6);
+}
+
+TEST(PieceTreeUtf8, FromTextLongAsciiBlocks) {
+    std::string text(40, 'x');
+    text[5] = '\n';
+    text[17] = '\n';
+    text += "\xC3\xA9";
+    text += std::string(20, 'y');
+    text[50] = '\n';
+
+    PieceTree::Piece p = PieceTree::Piece::fromText(NodeType::Original, 0, text);
+
+    ASSERT_EQ(p.line_breaks, (std::vector<PieceTree::Offset>{5, 17, 50}));
+    ASSERT_EQ(p.multibyte_chars.size(), 1);
+    ASSERT_EQ(p.multibyte_chars[0].offset, 40);
+}
+
+TEST(PieceTreeUtf8, Validation) {
+    ASSERT_TRUE(PieceTree::isValidUtf8("plain ascii text that is longer than one block"));
+    ASSERT_TRUE(PieceTree::isValidUtf8("\xE2\x82\xAC"));
+    ASSERT_FALSE(PieceTree::isValidUtf8("\xC0\xAF"));         // overlong
+    ASSERT_FALSE(PieceTree::isValidUtf8("\xED\xA0\x80"));     // surrogate
+    ASSERT_FALSE(PieceTree::isValidUtf8("\xE2\x82"));         // truncated
+    ASSERT_FALSE(PieceTree::isValidUtf8("\xF4\x90\x80\x80")); // above U+10FFFF
+}
+
+TEST(PieceTreeUtf8, ConvertAcrossPieces) {
+    PieceTree tree;
+
+    std::string added = "\xC3\xA9\xC3\xA9\n\xF0\x9F\x98\x80z"; // "éé\n😀z"
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, std::string_view(added).substr(0, 2)), 0, 0);
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 2, std::string_view(added).substr(2)), 0, 2);
+    /*
+        "é" "é\n
+         😀z"
+    */
+
+    ASSERT_EQ(tree.metrics().length, 10);
+    ASSERT_EQ(tree.metrics().code_points, 5);
+    ASSERT_EQ(tree.metrics().utf16_units, 6);
+
+    ASSERT_EQ(tree.convertOffset(4, PositionUnit::Byte, PositionUnit::CodePoint), 2);
+    ASSERT_EQ(tree.convertOffset(9, PositionUnit::Byte, PositionUnit::Utf16), 5);
+    ASSERT_EQ(tree.convertOffset(5, PositionUnit::Utf16, PositionUnit::Byte), 9);
+    ASSERT_EQ(tree.convertOffset(4, PositionUnit::CodePoint, PositionUnit::Byte), 9);
+
+    ASSERT_EQ(tree.convertColumn(0, 1, PositionUnit::CodePoint, PositionUnit::Byte), 2);
+    ASSERT_EQ(tree.convertColumn(1, 2, PositionUnit::Utf16, PositionUnit::Byte), 4);
+    ASSERT_EQ(tree.convertColumn(1, 4, PositionUnit::Byte, PositionUnit::CodePoint), 1);
+}
+
+TEST(PieceTreeUtf8, MetricsFollowRemoval) {
+    PieceTree tree;
+
+    std::string added = "a\xE2\x82\xAC" "b\n\xE2\x82\xAC"; // "a€b\n€"
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, added), 0, 0);
+
+    tree.remove(0, 1, 3); // € is deleted
+
+    std::vector<PieceTree::Piece> pieces = Util::collectPieces(tree);
+
+    ASSERT_EQ(pieces.size(), 2);
+    ASSERT_TRUE(pieces[0].multibyte_chars.empty());
+    ASSERT_EQ(pieces[1].multibyte_chars.size(), 1);
+    ASSERT_EQ(pieces[1].multibyte_chars[0].offset, 2);
+
+    ASSERT_EQ(tree.metrics().length, 6);
+    ASSERT_EQ(tree.metrics().code_points, 4);
+    ASSERT_EQ(tree.metrics().line_breaks, 1);
+}
+
+TEST(PieceTreeUtf8, ConvertMatchesCharacterWalk) {
+    // 1 to 4 byte characters mixed, so every table lookup lands on a different kind of neighbour
+    const char *chars[] = {"a", "\xC3\xA9", "\xE2\x82\xAC", "\xF0\x9F\x98\x80", "\n"};
+    std::string text;
+    std::vector<PieceTree::Offset> byte_of_code_point, byte_of_utf16;
+    for (int i = 0; i < 400; i++) {
+        std::string ch = chars[(i * 7 + i / 3) % 5];
+        byte_of_code_point.push_back(text.size());
+        byte_of_utf16.push_back(text.size());
+        if (ch.size() == 4)
+            byte_of_utf16.push_back(text.size()); // inside the surrogate pair
+        text += ch;
+    }
+
+    PieceTree tree;
+    tree.insert(PieceTree::Piece::fromText(NodeType::Added, 0, text), 0, 0);
+    tree.remove(0, 0, 1); // cut the head so the running counts are rebased
+    text.erase(0, 1);
+    for (auto *table : {&byte_of_code_point, &byte_of_utf16}) {
+        table->erase(table->begin());
+        for (auto &byte : *table)
+            byte -= 1;
+    }
+
+    for (std::size_t i = 0; i < byte_of_code_point.size(); i++)
+        ASSERT_EQ(tree.convertOffset(i, PositionUnit::CodePoint, PositionUnit::Byte), byte_of_code_point[i]) << i;
+    for (std::size_t i = 0; i < byte_of_utf16.size(); i++)
+        ASSERT_EQ(tree.convertOffset(i, PositionUnit::Utf16, PositionUnit::Byte), byte_of_utf16[i]) << i;
+    for (std::size_t i = 0; i < byte_of_code_point.size(); i++)
+        ASSERT_EQ(tree.convertOffset(byte_of_code_point[i], PositionUnit::Byte, PositionUnit::CodePoint), i) << i;
+    ASSERT_EQ(tree.metrics().code_points, byte_of_code_point.size());
+    ASSERT_EQ(tree.metrics().utf16_units, byte_of_utf16.size());
+    tree.checkInvariants();
+}
@@ -1,8 +1,40 @@
 #include "Util.h"
 
+#include <algorithm>
+#include <filesystem>
+#include <gtest/gtest.h>
 #include <iostream>
+#include <unistd.h>
 #include <vector>
 
+PieceTree::TextSource Buffers::source() {
+    return [this](const PieceTree::Piece &p) {
+        const std::string &buffer = p.type == NodeType::Original ? original : added;
+        return std::string_view(buffer).substr(p.offset, p.length);
+    };
+}
+
+PieceTree::Piece Buffers::add(std::string_view text) {
+    PieceTree::Piece p = PieceTree::Piece::fromText(NodeType::Added, added.size(), text);
+    added += text;
+    return p;
+}
+
+TempFile::TempFile(std::string_view name) {
+    const ::testing::TestInfo *test = ::testing::UnitTest::GetInstance()->current_test_info();
+    std::string unique = "piecetree_" + std::to_string(::getpid()) + "_";
+    if (test)
+        unique += std::string(test->test_suite_name()) + "." + test->name() + "_";
+    path = (std::filesystem::temp_directory_path() / (unique + std::string(name))).string();
+    std::filesystem::remove_all(path);
+}
+
+TempFile::~TempFile() {
+    std::error_code ignored;
+    std::filesystem::remove_all(path, ignored);
+    std::filesystem::remove(path + ".tmp", ignored);
+}
+
 std::vector<PieceTree::Piece> Util::collectPieces(PieceTree &tree) {
     std::vector<PieceTree::Piece> result;
     for (auto &piece : tree) {
@@ -15,10 +47,45 @@ void Util::printPieces(const std::vector<PieceTree::Piece>& pieces) {
     int i = 1;
     for (auto &piece : pieces) {
         std::cout << " piece " << i << " length: " << piece.length << " " << std::endl;
-        for (const int &x : piece.line_breaks) {
+        for (const PieceTree::Offset &x : piece.line_breaks) {
             std::cout << " piece "<< i << " linebreak: " << x << " ";
         }
         std::cout << std::endl;
         i++;
     }
 }
+
+std::string Util::textOf(PieceTree &tree, std::string_view original, std::string_view added) {
+    std::string text;
+    for (const auto &piece : tree)
+        text += (piece.type == NodeType::Original ? original : added).substr(piece.offset, piece.length);
+    return text;
+}
+
+std::string Util::randomText(std::mt19937 &rng, std::size_t length, std::string_view alphabet) {
+    std::string text(length, 'a');
+    for (char &ch : text) {
+        if (!alphabet.empty())
+            ch = alphabet[rng() % alphabet.size()];
+        else
+            ch = rng() % 5 == 0 ? '\n' : static_cast<char>('a' + rng() % 26);
+    }
+    return text;
+}
+
+void Util::randomEdit(std::mt19937 &rng, PieceTree &tree, std::string &text, std::string &added,
+                      PieceTree::Offset max_removed, std::size_t max_inserted, std::string_view alphabet) {
+    PieceTree::Offset offset = rng() % (text.size() + 1);
+    PieceTree::Offset line = tree.lineAt(offset);
+    PieceTree::Offset column = offset - tree.lineStartOffset(line);
+    if (rng() % 3 == 0 && offset < static_cast<PieceTree::Offset>(text.size())) {
+        PieceTree::Offset length = 1 + rng() % std::min<PieceTree::Offset>(max_removed, text.size() - offset);
+        tree.remove(line, column, length);
+        text.erase(offset, length);
+    } else {
+        std::string piece = randomText(rng, 1 + rng() % max_inserted, alphabet);
+        added += piece;
+        tree.insert(PieceTree::Piece::fromText(NodeType::Added, added.size() - piece.size(), piece), line, column);
+        text.insert(offset, piece);
+    }
+}
@@ -6,12 +6,45 @@
 #define UTIL_H
 #include "../include/PieceTree.h"
 
+#include <random>
+#include <string>
+#include <string_view>
 #include <vector>
 
+// Original and Added buffers owned by a test, as a text buffer would own them
+struct Buffers {
+    std::string original;
+    std::string added;
+
+    PieceTree::TextSource source();
+    // appends text to the Added buffer and returns the piece referring to it
+    PieceTree::Piece add(std::string_view text);
+};
+
+// a path in the shared temp directory, unique to the running test and process, removed with everything the test put
+// there (a directory, a leftover .tmp) when it goes out of scope
+struct TempFile {
+    std::string path;
+
+    explicit TempFile(std::string_view name);
+    TempFile(const TempFile &) = delete;
+    TempFile &operator=(const TempFile &) = delete;
+    ~TempFile();
+};
+
 class Util {
 public:
     static std::vector<PieceTree::Piece> collectPieces(PieceTree &tree);
     static void printPieces(const std::vector<PieceTree::Piece>& pieces);
+    static std::string textOf(PieceTree &tree, std::string_view original, std::string_view added);
+    // lowercase letters with about every fifth character a line break, or characters drawn from alphabet
+    static std::string randomText(std::mt19937 &rng, std::size_t length, std::string_view alphabet = {});
+    // random insert of at most max_inserted bytes or remove of at most max_removed bytes, applied to both the
+    // tree and the expected text. Inserted text goes to added before the tree sees it, so a text source over
+    // added can read it
+    static void randomEdit(std::mt19937 &rng, PieceTree &tree, std::string &text, std::string &added,
+                           PieceTree::Offset max_removed = 30, std::size_t max_inserted = 10,
+                           std::string_view alphabet = {});
 };
 
 